@@ -0,0 +1,257 @@
+#ifndef AVL_CORE_HPP
+#define AVL_CORE_HPP
+
+#include <algorithm>
+
+namespace AVLTree
+{
+    namespace detail
+    {
+        // Balancing primitives shared by every tree in the library.
+        //
+        // Node must provide `height`, `left`, `right` and a static
+        // `refresh(Node *)` hook that recomputes any per-node data derived
+        // from its children (a no-op for plain nodes). Children may be any
+        // type that converts to and is assignable from Node *, such as the
+        // offset pointers of SharedMultiSet.
+
+        template <typename Node>
+        inline short height(const Node *node)
+        {
+            return (node == nullptr) ? 0 : node->height;
+        }
+
+        template <typename Node>
+        inline int getBalance(const Node *node)
+        {
+            return (node == nullptr) ? 0 : height<Node>(node->left) - height<Node>(node->right);
+        }
+
+        template <typename Node>
+        inline void updateNode(Node *node)
+        {
+            node->height = 1 + std::max(height<Node>(node->left), height<Node>(node->right));
+            Node::refresh(node);
+        }
+
+        template <typename Node>
+        Node *rotateRight(Node *y)
+        {
+            Node *x = y->left;
+            Node *T2 = x->right;
+
+            x->right = y;
+            y->left = T2;
+
+            updateNode(y);
+            updateNode(x);
+
+            return x;
+        }
+
+        template <typename Node>
+        Node *rotateLeft(Node *x)
+        {
+            Node *y = x->right;
+            Node *T2 = y->left;
+
+            y->left = x;
+            x->right = T2;
+
+            updateNode(x);
+            updateNode(y);
+
+            return y;
+        }
+
+        // Recompute the node and restore the AVL invariant at it.
+        // Returns the new root of the subtree.
+        template <typename Node>
+        Node *rebalance(Node *node)
+        {
+            updateNode(node);
+            int balance = getBalance(node);
+
+            // Left Left Case
+            if (balance > 1 && getBalance<Node>(node->left) >= 0)
+                return rotateRight(node);
+            // Right Right Case
+            if (balance < -1 && getBalance<Node>(node->right) <= 0)
+                return rotateLeft(node);
+            // Left Right Case
+            if (balance > 1 && getBalance<Node>(node->left) < 0)
+            {
+                node->left = rotateLeft<Node>(node->left);
+                return rotateRight(node);
+            }
+            // Right Left Case
+            if (balance < -1 && getBalance<Node>(node->right) > 0)
+            {
+                node->right = rotateRight<Node>(node->right);
+                return rotateLeft(node);
+            }
+
+            return node;
+        }
+
+        // Rotations for rank-balanced trees: ranks are adjusted by the
+        // caller, only summaries are recomputed here.
+        template <typename Node>
+        Node *relinkRight(Node *y)
+        {
+            Node *x = y->left;
+            y->left = x->right;
+            x->right = y;
+            Node::refresh(y);
+            Node::refresh(x);
+            return x;
+        }
+
+        template <typename Node>
+        Node *relinkLeft(Node *x)
+        {
+            Node *y = x->right;
+            x->right = y->left;
+            y->left = x;
+            Node::refresh(x);
+            Node::refresh(y);
+            return y;
+        }
+
+        // Rank-balanced insertion repair at `node`, one of whose children
+        // was just promoted to node's own rank (a 0-child). Promotes node if
+        // its other child is a 1-child, otherwise finishes with one single
+        // or double rotation. Only assumes every other rank difference is
+        // at least 1, so it serves both WAVL and relaxed AVL trees.
+        template <typename Node>
+        Node *rankInsertFix(Node *node, bool left_heavy)
+        {
+            Node *sibling = left_heavy ? node->right : node->left;
+            if (node->height - height(sibling) == 1)
+            {
+                node->height++;
+                Node::refresh(node);
+                return node;
+            }
+            Node *x = left_heavy ? node->left : node->right;
+            Node *inner = left_heavy ? x->right : x->left;
+            if (x->height - height(inner) >= 2)
+            {
+                node->height--;
+                return left_heavy ? relinkRight(node) : relinkLeft(node);
+            }
+            if (left_heavy)
+                node->left = relinkLeft(x);
+            else
+                node->right = relinkRight(x);
+            inner->height++;
+            x->height--;
+            node->height--;
+            return left_heavy ? relinkRight(node) : relinkLeft(node);
+        }
+
+        // WAVL deletion repair at `node`, whose child on the `left_short`
+        // side sits three ranks below it.
+        template <typename Node>
+        Node *rankDeleteFix(Node *node, bool left_short)
+        {
+            Node *y = left_short ? node->right : node->left;
+            if (node->height - y->height == 2)
+            {
+                node->height--;
+                Node::refresh(node);
+                return node;
+            }
+            Node *outer = left_short ? y->right : y->left;
+            Node *inner = left_short ? y->left : y->right;
+            if (y->height - height(outer) == 2 && y->height - height(inner) == 2)
+            {
+                node->height--;
+                y->height--;
+                Node::refresh(node);
+                return node;
+            }
+            if (y->height - height(outer) == 1)
+            {
+                Node *top = left_short ? relinkLeft(node) : relinkRight(node);
+                top->height++;
+                node->height--;
+                if (node->left == nullptr && node->right == nullptr)
+                    node->height--;
+                return top;
+            }
+            if (left_short)
+                node->right = relinkRight(y);
+            else
+                node->left = relinkLeft(y);
+            Node *top = left_short ? relinkLeft(node) : relinkRight(node);
+            top->height += 2;
+            y->height--;
+            node->height -= 2;
+            return top;
+        }
+
+    } // namespace detail
+
+    // Balancing policies
+    //
+    // A policy supplies `static Node *rebalance(Node *)`, called bottom-up
+    // on every node of an update path once its children are final. It must
+    // refresh the node (Node::refresh) and return the new subtree root.
+    // `height` holds the policy's rank; perfectly balanced builds may set
+    // it with detail::updateNode under every policy.
+
+    // Strict AVL: sibling heights differ by at most one. Shallowest trees,
+    // but a deletion can rotate at every level of the path.
+    struct AVLBalance
+    {
+        template <typename Node>
+        static Node *rebalance(Node *node)
+        {
+            return detail::rebalance(node);
+        }
+    };
+
+    // Weak AVL (Haeupler, Sen, Tarjan): rank differences are 1 or 2 and
+    // leaves have rank 1. Insertions rebalance exactly like AVL; a deletion
+    // does at most two rotations and amortized O(1) demotions. Height stays
+    // within 2 log2 n, and within the AVL bound if nothing is deleted.
+    struct WAVLBalance
+    {
+        template <typename Node>
+        static Node *rebalance(Node *node)
+        {
+            int left = node->height - detail::height(node->left);
+            int right = node->height - detail::height(node->right);
+            if (left == 0 || right == 0)
+                return detail::rankInsertFix(node, left == 0);
+            if (left == 3 || right == 3)
+                return detail::rankDeleteFix(node, left == 3);
+            if (node->left == nullptr && node->right == nullptr && node->height == 2)
+                node->height--;
+            Node::refresh(node);
+            return node;
+        }
+    };
+
+    // Relaxed AVL (Sen, Tarjan: deletion without rebalancing): insertions
+    // rebalance by rank as in WAVL, deletions never restructure or change
+    // ranks. Height is O(log m) in the number of insertions m since the
+    // last rebuild, so delete-heavy sets should compact() now and then.
+    struct RelaxedBalance
+    {
+        template <typename Node>
+        static Node *rebalance(Node *node)
+        {
+            int left = node->height - detail::height(node->left);
+            int right = node->height - detail::height(node->right);
+            if (left == 0 || right == 0)
+                return detail::rankInsertFix(node, left == 0);
+            Node::refresh(node);
+            return node;
+        }
+    };
+
+} // namespace AVLTree
+
+#endif // AVL_CORE_HPP
@@ -2,6 +2,15 @@
 #define AVL_TREE_HPP
 
 #include "multiset.hpp"
+#include "journal.hpp"
 #include "set.hpp"
+#include "map.hpp"
+#include "sharded_multiset.hpp"
+#include "static_multiset.hpp"
+#include "sliding_window_quantile.hpp"
+#include "blocked_multiset.hpp"
+#include "merged_view.hpp"
+#include "interval_multiset.hpp"
+#include "shared_multiset.hpp"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,639 @@
+#ifndef BLOCKED_MULTISET_HPP
+#define BLOCKED_MULTISET_HPP
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "avl_core.hpp"
+#include "multiset.hpp"
+
+namespace AVLTree
+{
+
+    // MultiSet variant whose AVL nodes each hold a sorted run of up to B
+    // (key, count) entries in inline arrays. Every key in a node's left
+    // subtree is below its first key and every key in its right subtree
+    // above its last, so a lookup descends O(log(n / B)) nodes and finishes
+    // with a branch-free scan of one block. A 10M-key tree needs ~200K
+    // nodes instead of 10M, and in-order traversal reads whole blocks.
+    //
+    // Full blocks split in half; the upper half becomes the leftmost node
+    // of the right subtree. A block that drops below B / 4 entries merges
+    // with its in-order neighbour from its own subtrees, or is absorbed by
+    // its parent when it is a small leaf. T must be default-constructible.
+    template <typename T, size_t B = 64>
+    class BlockedMultiSet
+    {
+        static_assert(B >= 4, "Blocks need room for at least four entries");
+
+    private:
+        struct Node
+        {
+            short height;
+            size_t size;
+            Node *left;
+            Node *right;
+            T keys[B];
+            size_t counts[B];
+            Node() : height(1), size(0), left(nullptr), right(nullptr) {}
+
+            static void refresh(Node *) {}
+
+            // Index of the first entry >= key. Counting instead of breaking
+            // out early keeps the loop branch-free, so it vectorizes.
+            size_t position(const T &key) const
+            {
+                size_t pos = 0;
+                for (size_t i = 0; i < size; ++i)
+                    pos += keys[i] < key;
+                return pos;
+            }
+        };
+
+        static const size_t min_fill = B / 4;
+
+        Node *root;
+        size_t block_count;
+        size_t distinct_count;
+        size_t total_count;
+        size_t bulk_peak_bytes;
+
+        Node *createNode();
+        void destroyNode(Node *node);
+        Node *buildFromBlocks(std::vector<Node *> &blocks, size_t lo, size_t hi);
+        void rebuild(const std::vector<std::pair<T, size_t> > &entries);
+        Node *find(const T &key, size_t &pos) const;
+        Node *insert(Node *node, const T &key, size_t amount);
+        Node *attachMin(Node *node, Node *block);
+        Node *detachMin(Node *node, Node *&min);
+        Node *detachMax(Node *node, Node *&max);
+        Node *remove(Node *node, const T &key, size_t amount);
+        Node *unlink(Node *node);
+        void refill(Node *node);
+        void absorbChild(Node *node, bool left);
+        void clear(Node *node);
+        void collect(Node *node, std::vector<std::pair<T, size_t> > &entries) const;
+        void inorder(Node *node, std::vector<T> &result) const;
+
+    public:
+        BlockedMultiSet();
+        template <typename Iterator>
+        BlockedMultiSet(Iterator begin, Iterator end);
+        ~BlockedMultiSet();
+        template <typename Iterator>
+        void insert(Iterator begin, Iterator end);
+        void insert(const T &key);
+        void insert_multiple(const T &key, size_t amount);
+        void remove(const T &key);
+        void remove_multiple(const T &key, size_t amount);
+        void remove_all(const T &key);
+        size_t count(const T &key) const;
+        bool contains(const T &key) const;
+        T min() const;
+        T max() const;
+        T pop_min();
+        T pop_max();
+        size_t size() const;
+        bool empty() const;
+        size_t distinct_size() const;
+        size_t block_size() const;
+        MemoryUsage memory_usage() const;
+        void clear();
+        std::vector<T> to_vector() const;
+    };
+
+    template <typename T, size_t B>
+    const size_t BlockedMultiSet<T, B>::min_fill;
+
+    // Constructor and Destructor
+    template <typename T, size_t B>
+    BlockedMultiSet<T, B>::BlockedMultiSet()
+        : root(nullptr), block_count(0), distinct_count(0), total_count(0), bulk_peak_bytes(0) {}
+
+    template <typename T, size_t B>
+    template <typename Iterator>
+    BlockedMultiSet<T, B>::BlockedMultiSet(Iterator begin, Iterator end)
+        : root(nullptr), block_count(0), distinct_count(0), total_count(0), bulk_peak_bytes(0)
+    {
+        insert(begin, end);
+    }
+
+    template <typename T, size_t B>
+    BlockedMultiSet<T, B>::~BlockedMultiSet()
+    {
+        clear();
+    }
+
+    // Private Helper Methods
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::createNode()
+    {
+        block_count++;
+        return new Node();
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::destroyNode(Node *node)
+    {
+        block_count--;
+        delete node;
+    }
+
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::buildFromBlocks(std::vector<Node *> &blocks, size_t lo, size_t hi)
+    {
+        if (lo >= hi)
+            return nullptr;
+        size_t mid = lo + (hi - lo) / 2;
+        Node *node = blocks[mid];
+        node->left = buildFromBlocks(blocks, lo, mid);
+        node->right = buildFromBlocks(blocks, mid + 1, hi);
+        detail::updateNode(node);
+        return node;
+    }
+
+    // Replace the tree with sorted, distinct entries packed 3/4 full, which
+    // leaves room for inserts before the first splits.
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::rebuild(const std::vector<std::pair<T, size_t> > &entries)
+    {
+        clear();
+        const size_t fill = std::max<size_t>(min_fill, B * 3 / 4);
+        std::vector<Node *> blocks;
+        blocks.reserve(entries.size() / fill + 1);
+        size_t i = 0;
+        while (i < entries.size())
+        {
+            size_t end = std::min(entries.size(), i + fill);
+            // Avoid a runt final block by splitting the tail evenly
+            if (entries.size() - end > 0 && entries.size() - end < min_fill)
+                end = i + (entries.size() - i + 1) / 2;
+            Node *node = createNode();
+            for (; i < end; ++i)
+            {
+                node->keys[node->size] = entries[i].first;
+                node->counts[node->size++] = entries[i].second;
+                total_count += entries[i].second;
+            }
+            blocks.push_back(node);
+        }
+        distinct_count = entries.size();
+        root = buildFromBlocks(blocks, 0, blocks.size());
+    }
+
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::find(const T &key, size_t &pos) const
+    {
+        Node *node = root;
+        while (node)
+        {
+            if (key < node->keys[0])
+                node = node->left;
+            else if (node->keys[node->size - 1] < key)
+                node = node->right;
+            else
+            {
+                pos = node->position(key);
+                return node->keys[pos] == key ? node : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::insert(Node *node, const T &key, size_t amount)
+    {
+        if (node == nullptr)
+        {
+            node = createNode();
+            node->keys[0] = key;
+            node->counts[0] = amount;
+            node->size = 1;
+            distinct_count++;
+            total_count += amount;
+            return node;
+        }
+
+        if (key < node->keys[0] && node->left)
+        {
+            node->left = insert(node->left, key, amount);
+            return detail::rebalance(node);
+        }
+        if (node->keys[node->size - 1] < key && node->right)
+        {
+            node->right = insert(node->right, key, amount);
+            return detail::rebalance(node);
+        }
+
+        // The key belongs to this block
+        size_t pos = node->position(key);
+        total_count += amount;
+        if (pos < node->size && node->keys[pos] == key)
+        {
+            node->counts[pos] += amount;
+            return node;
+        }
+        distinct_count++;
+
+        Node *target = node;
+        if (node->size == B)
+        {
+            // Split: entries from `split` on move to a new block placed
+            // right after this one in key order. Appending to a full block
+            // (which has no right child) starts a fresh block instead, so
+            // ascending inserts leave full blocks behind.
+            Node *upper = createNode();
+            const size_t split = (pos == B) ? B : B / 2;
+            std::copy(node->keys + split, node->keys + B, upper->keys);
+            std::copy(node->counts + split, node->counts + B, upper->counts);
+            upper->size = B - split;
+            node->size = split;
+            node->right = attachMin(node->right, upper);
+            if (pos > split || pos == B)
+            {
+                target = upper;
+                pos -= split;
+            }
+        }
+        std::copy_backward(target->keys + pos, target->keys + target->size, target->keys + target->size + 1);
+        std::copy_backward(target->counts + pos, target->counts + target->size, target->counts + target->size + 1);
+        target->keys[pos] = key;
+        target->counts[pos] = amount;
+        target->size++;
+        return detail::rebalance(node);
+    }
+
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::attachMin(Node *node, Node *block)
+    {
+        if (node == nullptr)
+            return block;
+        node->left = attachMin(node->left, block);
+        return detail::rebalance(node);
+    }
+
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::detachMin(Node *node, Node *&min)
+    {
+        if (node->left == nullptr)
+        {
+            min = node;
+            return node->right;
+        }
+        node->left = detachMin(node->left, min);
+        return detail::rebalance(node);
+    }
+
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::detachMax(Node *node, Node *&max)
+    {
+        if (node->right == nullptr)
+        {
+            max = node;
+            return node->left;
+        }
+        node->right = detachMax(node->right, max);
+        return detail::rebalance(node);
+    }
+
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::remove(Node *node, const T &key, size_t amount)
+    {
+        if (node == nullptr)
+            return nullptr;
+
+        if (key < node->keys[0])
+        {
+            node->left = remove(node->left, key, amount);
+            absorbChild(node, true);
+            return detail::rebalance(node);
+        }
+        if (node->keys[node->size - 1] < key)
+        {
+            node->right = remove(node->right, key, amount);
+            absorbChild(node, false);
+            return detail::rebalance(node);
+        }
+
+        size_t pos = node->position(key);
+        if (node->keys[pos] != key)
+            return node;
+        size_t removed = std::min(amount, node->counts[pos]);
+        node->counts[pos] -= removed;
+        total_count -= removed;
+        if (node->counts[pos] > 0)
+            return node;
+
+        std::copy(node->keys + pos + 1, node->keys + node->size, node->keys + pos);
+        std::copy(node->counts + pos + 1, node->counts + node->size, node->counts + pos);
+        node->size--;
+        distinct_count--;
+        if (node->size == 0)
+            return unlink(node);
+        if (node->size < min_fill)
+            refill(node);
+        return detail::rebalance(node);
+    }
+
+    // Remove an empty block, moving its in-order successor into its place.
+    template <typename T, size_t B>
+    typename BlockedMultiSet<T, B>::Node *BlockedMultiSet<T, B>::unlink(Node *node)
+    {
+        Node *replacement;
+        if (node->left == nullptr || node->right == nullptr)
+        {
+            replacement = node->left ? node->left : node->right;
+        }
+        else
+        {
+            Node *right = detachMin(node->right, replacement);
+            replacement->left = node->left;
+            replacement->right = right;
+        }
+        destroyNode(node);
+        return replacement ? detail::rebalance(replacement) : nullptr;
+    }
+
+    // Merge an underfull block with its successor or predecessor block from
+    // its own subtrees when the two fit into one.
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::refill(Node *node)
+    {
+        if (node->right)
+        {
+            Node *next = node->right;
+            while (next->left)
+                next = next->left;
+            if (node->size + next->size <= B)
+            {
+                node->right = detachMin(node->right, next);
+                std::copy(next->keys, next->keys + next->size, node->keys + node->size);
+                std::copy(next->counts, next->counts + next->size, node->counts + node->size);
+                node->size += next->size;
+                destroyNode(next);
+                return;
+            }
+        }
+        if (node->left)
+        {
+            Node *prev = node->left;
+            while (prev->right)
+                prev = prev->right;
+            if (node->size + prev->size <= B)
+            {
+                node->left = detachMax(node->left, prev);
+                std::copy_backward(node->keys, node->keys + node->size, node->keys + node->size + prev->size);
+                std::copy_backward(node->counts, node->counts + node->size, node->counts + node->size + prev->size);
+                std::copy(prev->keys, prev->keys + prev->size, node->keys);
+                std::copy(prev->counts, prev->counts + prev->size, node->counts);
+                node->size += prev->size;
+                destroyNode(prev);
+            }
+        }
+    }
+
+    // Fold a small leaf child back into its parent block.
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::absorbChild(Node *node, bool left)
+    {
+        Node *child = left ? node->left : node->right;
+        if (child == nullptr || child->left || child->right || child->size >= min_fill || node->size + child->size > B)
+            return;
+        if (left)
+        {
+            std::copy_backward(node->keys, node->keys + node->size, node->keys + node->size + child->size);
+            std::copy_backward(node->counts, node->counts + node->size, node->counts + node->size + child->size);
+            std::copy(child->keys, child->keys + child->size, node->keys);
+            std::copy(child->counts, child->counts + child->size, node->counts);
+            node->left = nullptr;
+        }
+        else
+        {
+            std::copy(child->keys, child->keys + child->size, node->keys + node->size);
+            std::copy(child->counts, child->counts + child->size, node->counts + node->size);
+            node->right = nullptr;
+        }
+        node->size += child->size;
+        destroyNode(child);
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::clear(Node *node)
+    {
+        if (node == nullptr)
+            return;
+        clear(node->left);
+        clear(node->right);
+        destroyNode(node);
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::collect(Node *node, std::vector<std::pair<T, size_t> > &entries) const
+    {
+        if (node == nullptr)
+            return;
+        collect(node->left, entries);
+        for (size_t i = 0; i < node->size; ++i)
+            entries.push_back(std::make_pair(node->keys[i], node->counts[i]));
+        collect(node->right, entries);
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::inorder(Node *node, std::vector<T> &result) const
+    {
+        if (node == nullptr)
+            return;
+        inorder(node->left, result);
+        for (size_t i = 0; i < node->size; ++i)
+            result.insert(result.end(), node->counts[i], node->keys[i]);
+        inorder(node->right, result);
+    }
+
+    // Public Methods
+    template <typename T, size_t B>
+    template <typename Iterator>
+    void BlockedMultiSet<T, B>::insert(Iterator begin, Iterator end)
+    {
+        // If bulk is small compared to tree size, do individual insertions
+        size_t bulk_size = std::distance(begin, end);
+        if (bulk_size <= size() / 2)
+        {
+            for (Iterator it = begin; it != end; ++it)
+                insert(*it);
+            return;
+        }
+
+        std::vector<T> bulk_elements(begin, end);
+        std::sort(bulk_elements.begin(), bulk_elements.end());
+        std::vector<std::pair<T, size_t> > current;
+        current.reserve(distinct_count);
+        collect(root, current);
+
+        // Merge the existing runs with the sorted bulk, coalescing duplicates
+        std::vector<std::pair<T, size_t> > merged;
+        merged.reserve(current.size() + bulk_size);
+        size_t c = 0;
+        for (size_t i = 0; i < bulk_elements.size() || c < current.size();)
+        {
+            std::pair<T, size_t> next;
+            if (i == bulk_elements.size() || (c < current.size() && current[c].first < bulk_elements[i]))
+                next = current[c++];
+            else
+                next = std::make_pair(bulk_elements[i++], static_cast<size_t>(1));
+            if (!merged.empty() && merged.back().first == next.first)
+                merged.back().second += next.second;
+            else
+                merged.push_back(next);
+        }
+
+        size_t peak = bulk_elements.capacity() * sizeof(T) +
+                      (current.capacity() + merged.capacity()) * sizeof(std::pair<T, size_t>);
+        bulk_peak_bytes = std::max(bulk_peak_bytes, peak);
+        rebuild(merged);
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::insert(const T &key)
+    {
+        root = insert(root, key, 1);
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::insert_multiple(const T &key, size_t amount)
+    {
+        if (amount == 0)
+            return;
+        root = insert(root, key, amount);
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::remove(const T &key)
+    {
+        root = remove(root, key, 1);
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::remove_multiple(const T &key, size_t amount)
+    {
+        if (amount == 0)
+            return;
+        root = remove(root, key, amount);
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::remove_all(const T &key)
+    {
+        root = remove(root, key, total_count);
+    }
+
+    template <typename T, size_t B>
+    size_t BlockedMultiSet<T, B>::count(const T &key) const
+    {
+        size_t pos;
+        Node *node = find(key, pos);
+        return node ? node->counts[pos] : 0;
+    }
+
+    template <typename T, size_t B>
+    bool BlockedMultiSet<T, B>::contains(const T &key) const
+    {
+        size_t pos;
+        return find(key, pos) != nullptr;
+    }
+
+    template <typename T, size_t B>
+    T BlockedMultiSet<T, B>::min() const
+    {
+        if (!root)
+            throw std::runtime_error("Tree is empty");
+        Node *node = root;
+        while (node->left)
+            node = node->left;
+        return node->keys[0];
+    }
+
+    template <typename T, size_t B>
+    T BlockedMultiSet<T, B>::max() const
+    {
+        if (!root)
+            throw std::runtime_error("Tree is empty");
+        Node *node = root;
+        while (node->right)
+            node = node->right;
+        return node->keys[node->size - 1];
+    }
+
+    template <typename T, size_t B>
+    T BlockedMultiSet<T, B>::pop_min()
+    {
+        T minimum = min();
+        remove(minimum);
+        return minimum;
+    }
+
+    template <typename T, size_t B>
+    T BlockedMultiSet<T, B>::pop_max()
+    {
+        T maximum = max();
+        remove(maximum);
+        return maximum;
+    }
+
+    template <typename T, size_t B>
+    size_t BlockedMultiSet<T, B>::size() const
+    {
+        return total_count;
+    }
+
+    template <typename T, size_t B>
+    bool BlockedMultiSet<T, B>::empty() const
+    {
+        return total_count == 0;
+    }
+
+    template <typename T, size_t B>
+    size_t BlockedMultiSet<T, B>::distinct_size() const
+    {
+        return distinct_count;
+    }
+
+    // Number of blocks (tree nodes).
+    template <typename T, size_t B>
+    size_t BlockedMultiSet<T, B>::block_size() const
+    {
+        return block_count;
+    }
+
+    template <typename T, size_t B>
+    MemoryUsage BlockedMultiSet<T, B>::memory_usage() const
+    {
+        MemoryUsage usage;
+        usage.node_bytes = distinct_count * (sizeof(T) + sizeof(size_t)) + block_count * (sizeof(Node) - B * (sizeof(T) + sizeof(size_t)));
+        usage.allocator_slack = block_count * (detail::mallocChunkSize(sizeof(Node)) - sizeof(Node)) +
+                                (block_count * B - distinct_count) * (sizeof(T) + sizeof(size_t));
+        usage.bookkeeping_bytes = 0;
+        usage.bulk_peak_bytes = bulk_peak_bytes;
+        return usage;
+    }
+
+    template <typename T, size_t B>
+    void BlockedMultiSet<T, B>::clear()
+    {
+        clear(root);
+        root = nullptr;
+        distinct_count = 0;
+        total_count = 0;
+    }
+
+    template <typename T, size_t B>
+    std::vector<T> BlockedMultiSet<T, B>::to_vector() const
+    {
+        std::vector<T> result;
+        result.reserve(total_count);
+        inorder(root, result);
+        return result;
+    }
+
+} // namespace AVLTree
+
+#endif // BLOCKED_MULTISET_HPP
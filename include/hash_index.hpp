@@ -0,0 +1,284 @@
+#ifndef HASH_INDEX_HPP
+#define HASH_INDEX_HPP
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace AVLTree
+{
+    namespace detail
+    {
+        // Open-addressing hash map in the Swiss table style. Every slot has
+        // a metadata byte (empty, deleted, or 7 bits of the key's hash) and
+        // lookups compare a whole group of 16 metadata bytes at once, with
+        // SSE2 where available and a scalar loop otherwise, so a probe
+        // usually reads one metadata group and one slot. Groups are visited
+        // in triangular order, which covers every group of a power-of-two
+        // table. The table is kept at most 7/8 full, tombstones included.
+        template <typename K, typename V, typename Hash = std::hash<K> >
+        class SwissIndex
+        {
+        public:
+            SwissIndex();
+
+            V find(const K &key) const; // V() when absent
+            void insert(const K &key, const V &value); // adds or overwrites
+            bool erase(const K &key, const V &value); // only if key maps to value
+            void reserve(size_t n);
+            void clear();
+            size_t size() const;
+            size_t memory_bytes() const;
+
+        private:
+            static const size_t group_size = 16;
+            static const signed char empty_slot = -128;
+            static const signed char deleted_slot = -2;
+
+            struct Slot
+            {
+                K key;
+                V value;
+            };
+
+            std::vector<signed char> ctrl;
+            std::vector<Slot> slots;
+            size_t group_mask; // group count - 1
+            size_t used;
+            size_t deleted;
+            Hash hasher;
+
+            size_t hashOf(const K &key) const;
+            static unsigned match(const signed char *group, signed char tag);
+            static unsigned matchFree(const signed char *group);
+            static unsigned lowestBit(unsigned mask);
+            bool locate(const K &key, size_t hash, size_t &index) const;
+            void place(const K &key, const V &value, size_t hash);
+            void rehash(size_t groups);
+        };
+
+        template <typename K, typename V, typename Hash>
+        const size_t SwissIndex<K, V, Hash>::group_size;
+        template <typename K, typename V, typename Hash>
+        const signed char SwissIndex<K, V, Hash>::empty_slot;
+        template <typename K, typename V, typename Hash>
+        const signed char SwissIndex<K, V, Hash>::deleted_slot;
+
+        // Constructor
+        template <typename K, typename V, typename Hash>
+        SwissIndex<K, V, Hash>::SwissIndex() : group_mask(0), used(0), deleted(0) {}
+
+        // Private Helper Methods
+
+        // std::hash is the identity for integers; mix so both the group
+        // index (high bits) and the tag (low 7 bits) vary.
+        template <typename K, typename V, typename Hash>
+        size_t SwissIndex<K, V, Hash>::hashOf(const K &key) const
+        {
+            uint64_t h = static_cast<uint64_t>(hasher(key));
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            return static_cast<size_t>(h);
+        }
+
+        // Bit i is set when group[i] == tag.
+        template <typename K, typename V, typename Hash>
+        unsigned SwissIndex<K, V, Hash>::match(const signed char *group, signed char tag)
+        {
+#if defined(__SSE2__)
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+            return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(tag))));
+#else
+            unsigned mask = 0;
+            for (size_t i = 0; i < group_size; ++i)
+                mask |= static_cast<unsigned>(group[i] == tag) << i;
+            return mask;
+#endif
+        }
+
+        // Bit i is set when group[i] is empty or deleted (sign bit set).
+        template <typename K, typename V, typename Hash>
+        unsigned SwissIndex<K, V, Hash>::matchFree(const signed char *group)
+        {
+#if defined(__SSE2__)
+            return static_cast<unsigned>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(group))));
+#else
+            unsigned mask = 0;
+            for (size_t i = 0; i < group_size; ++i)
+                mask |= static_cast<unsigned>(group[i] < 0) << i;
+            return mask;
+#endif
+        }
+
+        template <typename K, typename V, typename Hash>
+        unsigned SwissIndex<K, V, Hash>::lowestBit(unsigned mask)
+        {
+#if defined(__GNUC__)
+            return static_cast<unsigned>(__builtin_ctz(mask));
+#else
+            unsigned bit = 0;
+            while (!(mask & 1u))
+            {
+                mask >>= 1;
+                ++bit;
+            }
+            return bit;
+#endif
+        }
+
+        template <typename K, typename V, typename Hash>
+        bool SwissIndex<K, V, Hash>::locate(const K &key, size_t hash, size_t &index) const
+        {
+            signed char tag = static_cast<signed char>(hash & 0x7F);
+            size_t group = (hash >> 7) & group_mask;
+            for (size_t step = 1;; ++step)
+            {
+                const signed char *metadata = &ctrl[group * group_size];
+                for (unsigned mask = match(metadata, tag); mask != 0; mask &= mask - 1)
+                {
+                    size_t i = group * group_size + lowestBit(mask);
+                    if (slots[i].key == key)
+                    {
+                        index = i;
+                        return true;
+                    }
+                }
+                if (match(metadata, empty_slot) != 0)
+                    return false;
+                group = (group + step) & group_mask;
+            }
+        }
+
+        // Store a key known to be absent in the first free slot of its
+        // probe sequence.
+        template <typename K, typename V, typename Hash>
+        void SwissIndex<K, V, Hash>::place(const K &key, const V &value, size_t hash)
+        {
+            size_t group = (hash >> 7) & group_mask;
+            for (size_t step = 1;; ++step)
+            {
+                unsigned mask = matchFree(&ctrl[group * group_size]);
+                if (mask != 0)
+                {
+                    size_t i = group * group_size + lowestBit(mask);
+                    if (ctrl[i] == deleted_slot)
+                        deleted--;
+                    ctrl[i] = static_cast<signed char>(hash & 0x7F);
+                    slots[i].key = key;
+                    slots[i].value = value;
+                    used++;
+                    return;
+                }
+                group = (group + step) & group_mask;
+            }
+        }
+
+        template <typename K, typename V, typename Hash>
+        void SwissIndex<K, V, Hash>::rehash(size_t groups)
+        {
+            std::vector<signed char> old_ctrl(groups * group_size, empty_slot);
+            std::vector<Slot> old_slots(groups * group_size);
+            old_ctrl.swap(ctrl);
+            old_slots.swap(slots);
+            group_mask = groups - 1;
+            used = 0;
+            deleted = 0;
+            for (size_t i = 0; i < old_ctrl.size(); ++i)
+            {
+                if (old_ctrl[i] >= 0)
+                    place(old_slots[i].key, old_slots[i].value, hashOf(old_slots[i].key));
+            }
+        }
+
+        // Public Methods
+        template <typename K, typename V, typename Hash>
+        V SwissIndex<K, V, Hash>::find(const K &key) const
+        {
+            size_t index;
+            if (used == 0 || !locate(key, hashOf(key), index))
+                return V();
+            return slots[index].value;
+        }
+
+        template <typename K, typename V, typename Hash>
+        void SwissIndex<K, V, Hash>::insert(const K &key, const V &value)
+        {
+            size_t hash = hashOf(key);
+            size_t index;
+            if (!slots.empty() && locate(key, hash, index))
+            {
+                slots[index].value = value;
+                return;
+            }
+            if ((used + deleted + 1) * 8 > slots.size() * 7)
+            {
+                // Grow when live entries fill half the table, otherwise
+                // rehashing in place is enough to clear the tombstones
+                size_t groups = slots.size() / group_size;
+                rehash(groups == 0 ? 1 : (used + 1) * 2 > slots.size() ? groups * 2 : groups);
+            }
+            place(key, value, hash);
+        }
+
+        // A slot in a group that still has an empty slot can go back to
+        // empty: no probe sequence ever continued past that group.
+        template <typename K, typename V, typename Hash>
+        bool SwissIndex<K, V, Hash>::erase(const K &key, const V &value)
+        {
+            size_t index;
+            if (used == 0 || !locate(key, hashOf(key), index) || !(slots[index].value == value))
+                return false;
+            size_t group = index / group_size;
+            if (match(&ctrl[group * group_size], empty_slot) != 0)
+            {
+                ctrl[index] = empty_slot;
+            }
+            else
+            {
+                ctrl[index] = deleted_slot;
+                deleted++;
+            }
+            used--;
+            return true;
+        }
+
+        template <typename K, typename V, typename Hash>
+        void SwissIndex<K, V, Hash>::reserve(size_t n)
+        {
+            size_t groups = 1;
+            while (groups * group_size * 7 < n * 8)
+                groups *= 2;
+            if (groups * group_size > slots.size())
+                rehash(groups);
+        }
+
+        template <typename K, typename V, typename Hash>
+        void SwissIndex<K, V, Hash>::clear()
+        {
+            std::vector<signed char>().swap(ctrl);
+            std::vector<Slot>().swap(slots);
+            group_mask = 0;
+            used = 0;
+            deleted = 0;
+        }
+
+        template <typename K, typename V, typename Hash>
+        size_t SwissIndex<K, V, Hash>::size() const
+        {
+            return used;
+        }
+
+        template <typename K, typename V, typename Hash>
+        size_t SwissIndex<K, V, Hash>::memory_bytes() const
+        {
+            return ctrl.capacity() + slots.capacity() * sizeof(Slot);
+        }
+
+    } // namespace detail
+} // namespace AVLTree
+
+#endif // HASH_INDEX_HPP
@@ -0,0 +1,486 @@
+#ifndef INTERVAL_MULTISET_HPP
+#define INTERVAL_MULTISET_HPP
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "avl_core.hpp"
+
+namespace AVLTree
+{
+
+    // Closed interval [start, end], ordered by start and then by end.
+    template <typename T>
+    struct Interval
+    {
+        T start;
+        T end;
+
+        Interval() : start(), end() {}
+        Interval(const T &start, const T &end) : start(start), end(end) {}
+
+        bool operator<(const Interval &other) const
+        {
+            return start < other.start || (!(other.start < start) && end < other.end);
+        }
+        bool operator==(const Interval &other) const
+        {
+            return !(*this < other) && !(other < *this);
+        }
+    };
+
+    // Multiset of closed intervals answering overlap and stabbing queries.
+    //
+    // Nodes are keyed by interval (start first) and every node keeps the
+    // largest end in its subtree, recomputed by Node::refresh whenever the
+    // shared AVL primitives rotate or rebuild a node. A query [lo, hi]
+    // skips every subtree whose largest end is below lo and everything
+    // right of a node starting after hi. A query reporting k distinct
+    // intervals costs O(min(n, log n + k log n)) in the worst case, not
+    // the O(log n + k) of an interval tree with per-node end lists:
+    // intervals starting inside the query cost O(1) each after the first
+    // descent, but those starting before lo are found through the max
+    // ends, up to O(log n) nodes each (usually far fewer, as the paths to
+    // them share their upper levels). Results are passed in order to a
+    // callback as (const Interval<T> &, size_t count), one call per
+    // distinct interval, and nothing is allocated.
+    template <typename T>
+    class IntervalMultiSet
+    {
+    public:
+        typedef Interval<T> interval_type;
+
+    private:
+        struct Node
+        {
+            interval_type key;
+            T max_end;
+            short height;
+            size_t count;
+            Node *left;
+            Node *right;
+            Node(const interval_type &k, size_t c)
+                : key(k), max_end(k.end), height(1), count(c), left(nullptr), right(nullptr) {}
+
+            static void refresh(Node *node)
+            {
+                node->max_end = node->key.end;
+                if (node->left && node->max_end < node->left->max_end)
+                    node->max_end = node->left->max_end;
+                if (node->right && node->max_end < node->right->max_end)
+                    node->max_end = node->right->max_end;
+            }
+        };
+
+        Node *root;
+        size_t distinct_count;
+        size_t total_count;
+
+        static void validate(const interval_type &interval);
+        Node *buildFromSorted(const std::vector<interval_type> &keys, const std::vector<size_t> &runs, size_t lo, size_t hi);
+        void rebuild(const std::vector<interval_type> &sorted);
+        Node *insert(Node *node, const interval_type &key, size_t amount);
+        Node *remove(Node *node, const interval_type &key, size_t amount);
+        Node *find(const interval_type &key) const;
+        template <typename Callback>
+        void overlap(const Node *node, const T &lo, const T &hi, Callback &callback) const;
+        template <typename Callback>
+        void reportUpTo(const Node *node, const T &hi, Callback &callback) const;
+        template <typename Callback>
+        void reportAll(const Node *node, Callback &callback) const;
+        void clear(Node *node);
+        void inorder(Node *node, std::vector<interval_type> &result) const;
+
+    public:
+        IntervalMultiSet();
+        template <typename Iterator>
+        IntervalMultiSet(Iterator begin, Iterator end);
+        ~IntervalMultiSet();
+        template <typename Iterator>
+        void insert(Iterator begin, Iterator end);
+        void insert(const interval_type &interval);
+        void insert(const T &start, const T &end);
+        void insert_multiple(const interval_type &interval, size_t amount);
+        void remove(const interval_type &interval);
+        void remove_multiple(const interval_type &interval, size_t amount);
+        void remove_all(const interval_type &interval);
+        size_t count(const interval_type &interval) const;
+        bool contains(const interval_type &interval) const;
+        template <typename Callback>
+        void overlap(const T &lo, const T &hi, Callback callback) const;
+        template <typename Callback>
+        void stab(const T &point, Callback callback) const;
+        size_t size() const;
+        bool empty() const;
+        size_t distinct_size() const;
+        void clear();
+        std::vector<interval_type> to_vector() const;
+
+    private:
+        IntervalMultiSet(const IntervalMultiSet &);
+        IntervalMultiSet &operator=(const IntervalMultiSet &);
+    };
+
+    // Constructor and Destructor
+    template <typename T>
+    IntervalMultiSet<T>::IntervalMultiSet() : root(nullptr), distinct_count(0), total_count(0) {}
+
+    template <typename T>
+    template <typename Iterator>
+    IntervalMultiSet<T>::IntervalMultiSet(Iterator begin, Iterator end) : root(nullptr), distinct_count(0), total_count(0)
+    {
+        insert(begin, end);
+    }
+
+    template <typename T>
+    IntervalMultiSet<T>::~IntervalMultiSet()
+    {
+        clear();
+    }
+
+    // Private Helper Methods
+    template <typename T>
+    void IntervalMultiSet<T>::validate(const interval_type &interval)
+    {
+        if (interval.end < interval.start)
+            throw std::invalid_argument("Interval ends before it starts");
+    }
+
+    template <typename T>
+    typename IntervalMultiSet<T>::Node *IntervalMultiSet<T>::buildFromSorted(const std::vector<interval_type> &keys, const std::vector<size_t> &runs, size_t lo, size_t hi)
+    {
+        if (lo >= hi)
+            return nullptr;
+
+        // Allocating in key order keeps queries, which walk the tree in
+        // order, close to sequential in memory
+        size_t mid = lo + (hi - lo) / 2;
+        Node *left = buildFromSorted(keys, runs, lo, mid);
+        size_t count = runs[mid + 1] - runs[mid];
+        Node *node = new Node(keys[runs[mid]], count);
+        distinct_count++;
+        total_count += count;
+
+        node->left = left;
+        node->right = buildFromSorted(keys, runs, mid + 1, hi);
+        detail::updateNode(node);
+
+        return node;
+    }
+
+    // Replace the tree with the sorted intervals in O(n).
+    template <typename T>
+    void IntervalMultiSet<T>::rebuild(const std::vector<interval_type> &sorted)
+    {
+        std::vector<size_t> runs;
+        for (size_t i = 0; i < sorted.size(); ++i)
+        {
+            if (i == 0 || !(sorted[i - 1] == sorted[i]))
+                runs.push_back(i);
+        }
+        runs.push_back(sorted.size());
+
+        clear();
+        root = buildFromSorted(sorted, runs, 0, runs.size() - 1);
+    }
+
+    template <typename T>
+    typename IntervalMultiSet<T>::Node *IntervalMultiSet<T>::insert(Node *node, const interval_type &key, size_t amount)
+    {
+        if (node == nullptr)
+        {
+            distinct_count++;
+            total_count += amount;
+            return new Node(key, amount);
+        }
+
+        if (key < node->key)
+            node->left = insert(node->left, key, amount);
+        else if (node->key < key)
+            node->right = insert(node->right, key, amount);
+        else
+        {
+            node->count += amount;
+            total_count += amount;
+            return node;
+        }
+
+        return detail::rebalance(node);
+    }
+
+    template <typename T>
+    typename IntervalMultiSet<T>::Node *IntervalMultiSet<T>::remove(Node *node, const interval_type &key, size_t amount)
+    {
+        if (node == nullptr)
+            return node;
+
+        if (key < node->key)
+            node->left = remove(node->left, key, amount);
+        else if (node->key < key)
+            node->right = remove(node->right, key, amount);
+        else if (amount < node->count)
+        {
+            node->count -= amount;
+            total_count -= amount;
+            return node;
+        }
+        else if (node->left == nullptr || node->right == nullptr)
+        {
+            total_count -= node->count;
+            distinct_count--;
+            Node *child = node->left ? node->left : node->right;
+            delete node;
+            return child;
+        }
+        else
+        {
+            // Two children: take over the inorder successor, then remove it
+            Node *successor = node->right;
+            while (successor->left)
+                successor = successor->left;
+            total_count = total_count + successor->count - node->count;
+            node->key = successor->key;
+            node->count = successor->count;
+            node->right = remove(node->right, successor->key, successor->count);
+        }
+
+        return detail::rebalance(node);
+    }
+
+    template <typename T>
+    typename IntervalMultiSet<T>::Node *IntervalMultiSet<T>::find(const interval_type &key) const
+    {
+        Node *node = root;
+        while (node)
+        {
+            if (key < node->key)
+                node = node->left;
+            else if (node->key < key)
+                node = node->right;
+            else
+                return node;
+        }
+        return nullptr;
+    }
+
+    // Intervals starting before lo overlap when they reach lo, which the
+    // max ends answer; from the first node starting at or after lo, the
+    // rest overlap exactly when they start by hi, so those are reported
+    // without looking at ends.
+    template <typename T>
+    template <typename Callback>
+    void IntervalMultiSet<T>::overlap(const Node *node, const T &lo, const T &hi, Callback &callback) const
+    {
+        while (node && !(node->max_end < lo))
+        {
+            if (node->left && !(node->left->max_end < lo))
+                overlap(node->left, lo, hi, callback);
+            if (hi < node->key.start)
+                return; // so does everything to the right
+            if (!(node->key.start < lo))
+            {
+                callback(node->key, node->count);
+                reportUpTo(node->right, hi, callback);
+                return;
+            }
+            if (!(node->key.end < lo))
+                callback(node->key, node->count);
+            node = node->right;
+        }
+    }
+
+    // Report every interval starting by hi.
+    template <typename T>
+    template <typename Callback>
+    void IntervalMultiSet<T>::reportUpTo(const Node *node, const T &hi, Callback &callback) const
+    {
+        while (node)
+        {
+            if (hi < node->key.start)
+            {
+                node = node->left;
+                continue;
+            }
+            reportAll(node->left, callback);
+            callback(node->key, node->count);
+            node = node->right;
+        }
+    }
+
+    template <typename T>
+    template <typename Callback>
+    void IntervalMultiSet<T>::reportAll(const Node *node, Callback &callback) const
+    {
+        while (node)
+        {
+            if (node->left)
+                reportAll(node->left, callback);
+            callback(node->key, node->count);
+            node = node->right;
+        }
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::clear(Node *node)
+    {
+        if (node == nullptr)
+            return;
+        clear(node->left);
+        clear(node->right);
+        delete node;
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::inorder(Node *node, std::vector<interval_type> &result) const
+    {
+        if (node == nullptr)
+            return;
+        inorder(node->left, result);
+        result.insert(result.end(), node->count, node->key);
+        inorder(node->right, result);
+    }
+
+    // Public Methods
+
+    // Intervals already in order are merged without sorting, so a bulk
+    // build from sorted input is a single O(n) pass.
+    template <typename T>
+    template <typename Iterator>
+    void IntervalMultiSet<T>::insert(Iterator begin, Iterator end)
+    {
+        size_t bulk_size = std::distance(begin, end);
+        if (bulk_size <= size() / 2)
+        {
+            for (Iterator it = begin; it != end; ++it)
+                insert(*it);
+            return;
+        }
+
+        std::vector<interval_type> bulk(begin, end);
+        for (size_t i = 0; i < bulk.size(); ++i)
+            validate(bulk[i]);
+        if (!std::is_sorted(bulk.begin(), bulk.end()))
+            std::sort(bulk.begin(), bulk.end());
+
+        std::vector<interval_type> merged;
+        merged.reserve(total_count + bulk.size());
+        inorder(root, merged);
+        size_t existing = merged.size();
+        merged.insert(merged.end(), bulk.begin(), bulk.end());
+        std::inplace_merge(merged.begin(), merged.begin() + existing, merged.end());
+        rebuild(merged);
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::insert(const interval_type &interval)
+    {
+        insert_multiple(interval, 1);
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::insert(const T &start, const T &end)
+    {
+        insert_multiple(interval_type(start, end), 1);
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::insert_multiple(const interval_type &interval, size_t amount)
+    {
+        validate(interval);
+        if (amount == 0)
+            return;
+        root = insert(root, interval, amount);
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::remove(const interval_type &interval)
+    {
+        root = remove(root, interval, 1);
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::remove_multiple(const interval_type &interval, size_t amount)
+    {
+        if (amount == 0)
+            return;
+        root = remove(root, interval, amount);
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::remove_all(const interval_type &interval)
+    {
+        Node *node = find(interval);
+        if (node)
+            root = remove(root, interval, node->count);
+    }
+
+    template <typename T>
+    size_t IntervalMultiSet<T>::count(const interval_type &interval) const
+    {
+        Node *node = find(interval);
+        return node ? node->count : 0;
+    }
+
+    template <typename T>
+    bool IntervalMultiSet<T>::contains(const interval_type &interval) const
+    {
+        return find(interval) != nullptr;
+    }
+
+    // Report every interval sharing at least one point with [lo, hi].
+    template <typename T>
+    template <typename Callback>
+    void IntervalMultiSet<T>::overlap(const T &lo, const T &hi, Callback callback) const
+    {
+        if (hi < lo)
+            throw std::invalid_argument("Query interval ends before it starts");
+        overlap(root, lo, hi, callback);
+    }
+
+    // Report every interval containing point.
+    template <typename T>
+    template <typename Callback>
+    void IntervalMultiSet<T>::stab(const T &point, Callback callback) const
+    {
+        overlap(root, point, point, callback);
+    }
+
+    template <typename T>
+    size_t IntervalMultiSet<T>::size() const
+    {
+        return total_count;
+    }
+
+    template <typename T>
+    bool IntervalMultiSet<T>::empty() const
+    {
+        return total_count == 0;
+    }
+
+    template <typename T>
+    size_t IntervalMultiSet<T>::distinct_size() const
+    {
+        return distinct_count;
+    }
+
+    template <typename T>
+    void IntervalMultiSet<T>::clear()
+    {
+        clear(root);
+        root = nullptr;
+        distinct_count = 0;
+        total_count = 0;
+    }
+
+    template <typename T>
+    std::vector<typename IntervalMultiSet<T>::interval_type> IntervalMultiSet<T>::to_vector() const
+    {
+        std::vector<interval_type> result;
+        result.reserve(total_count);
+        inorder(root, result);
+        return result;
+    }
+
+} // namespace AVLTree
+
+#endif // INTERVAL_MULTISET_HPP
@@ -0,0 +1,500 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <vector>
+#include <map>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "multiset.hpp"
+
+namespace AVLTree
+{
+
+    // Write-ahead log of MultiSet mutations.
+    //
+    // Records are buffered and written with a single write() + fdatasync()
+    // once `commit_batch` records are pending or `flush_interval` has passed
+    // since the last commit (checked on append), so the fsync cost is shared
+    // by the whole group. checkpoint() stores a sorted snapshot and starts a
+    // new journal generation; recover() loads the snapshot, folds the newer
+    // journal records into per-key counts and rebuilds the set from those
+    // (key, count) runs, so its memory follows the distinct keys.
+    //
+    // Files: <path> (journal) and <path>.snapshot. Keys are stored as raw
+    // bytes, so T must be trivially copyable. This header needs POSIX file
+    // I/O; multiset.hpp only declares Journal, so include this one where a
+    // journal is attached.
+    template <typename T>
+    class Journal
+    {
+    public:
+        explicit Journal(const std::string &path, size_t commit_batch = 64,
+                         std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10));
+        ~Journal();
+
+        void append(JournalOp op, const T &key, uint64_t amount = 1);
+        void sync();
+        size_t pending() const;
+        template <typename Augment, typename Storage, typename Balance>
+        void checkpoint(const MultiSet<T, Augment, Storage, Balance> &set);
+        template <typename Augment, typename Storage, typename Balance>
+        void recover(MultiSet<T, Augment, Storage, Balance> &set);
+
+    private:
+        static const uint32_t journal_magic = 0x4a4c5641;  // "AVLJ"
+        static const uint32_t snapshot_magic = 0x534c5641; // "AVLS"
+
+        std::string path;
+        std::string snapshot_path;
+        int fd;
+        uint64_t generation;
+        size_t commit_batch;
+        std::chrono::milliseconds flush_interval;
+        std::chrono::steady_clock::time_point last_sync;
+        std::vector<char> buffer;
+        size_t buffered_records;
+
+        Journal(const Journal &);
+        Journal &operator=(const Journal &);
+
+        static void fail(const std::string &what);
+        static void writeAll(int fd, const char *data, size_t size);
+        template <typename V>
+        static void put(std::vector<char> &out, const V &value);
+        template <typename V>
+        static bool get(const std::vector<char> &in, size_t &pos, V &value);
+        static bool readFile(const std::string &file, std::vector<char> &data);
+        static bool readRecord(const std::vector<char> &in, size_t &pos, JournalOp &op, T &key, uint64_t &amount);
+        static void syncDirectory(const std::string &file);
+        void writeHeader();
+        uint64_t snapshotGeneration() const;
+        uint64_t readSnapshot(std::vector<std::pair<T, uint64_t> > &entries) const;
+    };
+
+    template <typename T>
+    const uint32_t Journal<T>::journal_magic;
+    template <typename T>
+    const uint32_t Journal<T>::snapshot_magic;
+
+    // Constructor and Destructor
+    template <typename T>
+    Journal<T>::Journal(const std::string &path, size_t commit_batch, std::chrono::milliseconds flush_interval)
+        : path(path), snapshot_path(path + ".snapshot"), fd(-1), generation(1),
+          commit_batch(commit_batch ? commit_batch : 1), flush_interval(flush_interval),
+          last_sync(std::chrono::steady_clock::now()), buffered_records(0)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Journal keys are stored as raw bytes");
+        std::vector<char> existing;
+        readFile(path, existing);
+        uint64_t covers = snapshotGeneration();
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+            fail("open " + path);
+
+        size_t pos = 0;
+        uint32_t magic = 0, key_size = 0;
+        bool has_header = get(existing, pos, magic) && get(existing, pos, key_size) && get(existing, pos, generation);
+        if (has_header && (magic != journal_magic || key_size != sizeof(T)))
+        {
+            ::close(fd);
+            throw std::runtime_error("Journal " + path + " has an incompatible format");
+        }
+
+        // A new journal, or one the snapshot already covers (a checkpoint
+        // crashed between renaming the snapshot and truncating the
+        // journal), restarts after the snapshot's generation. Appending to
+        // a covered journal would lose every record to recover().
+        if (!has_header || generation <= covers)
+        {
+            generation = covers + 1;
+            if (::ftruncate(fd, 0) != 0)
+                fail("truncate " + path);
+            writeHeader();
+            return;
+        }
+
+        // Cut a torn or corrupt tail so new records are framed correctly
+        JournalOp op;
+        T key;
+        uint64_t amount;
+        while (readRecord(existing, pos, op, key, amount))
+        {
+        }
+        if (pos < existing.size())
+        {
+            if (::ftruncate(fd, pos) != 0)
+                fail("truncate " + path);
+            if (::fdatasync(fd) != 0)
+                fail("fsync " + path);
+        }
+    }
+
+    template <typename T>
+    Journal<T>::~Journal()
+    {
+        try
+        {
+            sync();
+        }
+        catch (...)
+        {
+        }
+        ::close(fd);
+    }
+
+    // Private Helper Methods
+    template <typename T>
+    void Journal<T>::fail(const std::string &what)
+    {
+        throw std::runtime_error("Journal: " + what + ": " + std::strerror(errno));
+    }
+
+    template <typename T>
+    void Journal<T>::writeAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                fail("write");
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    template <typename T>
+    template <typename V>
+    void Journal<T>::put(std::vector<char> &out, const V &value)
+    {
+        const char *bytes = reinterpret_cast<const char *>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(V));
+    }
+
+    template <typename T>
+    template <typename V>
+    bool Journal<T>::get(const std::vector<char> &in, size_t &pos, V &value)
+    {
+        if (in.size() - pos < sizeof(V))
+            return false;
+        std::memcpy(&value, in.data() + pos, sizeof(V));
+        pos += sizeof(V);
+        return true;
+    }
+
+    template <typename T>
+    bool Journal<T>::readFile(const std::string &file, std::vector<char> &data)
+    {
+        data.clear();
+        int in = ::open(file.c_str(), O_RDONLY);
+        if (in < 0)
+            return false;
+        char chunk[1 << 16];
+        ssize_t got;
+        while ((got = ::read(in, chunk, sizeof(chunk))) != 0)
+        {
+            if (got < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                ::close(in);
+                fail("read " + file);
+            }
+            data.insert(data.end(), chunk, chunk + got);
+        }
+        ::close(in);
+        return true;
+    }
+
+    // Decode the record at pos and move past it. Fails, leaving pos alone,
+    // on a torn record or an unknown op byte.
+    template <typename T>
+    bool Journal<T>::readRecord(const std::vector<char> &in, size_t &pos, JournalOp &op, T &key, uint64_t &amount)
+    {
+        size_t next = pos;
+        if (next >= in.size())
+            return false;
+        op = static_cast<JournalOp>(in[next++]);
+        if (op < JournalOp::Insert || op > JournalOp::Clear)
+            return false;
+        if (op != JournalOp::Clear && !get(in, next, key))
+            return false;
+        if ((op == JournalOp::InsertMultiple || op == JournalOp::RemoveMultiple) && !get(in, next, amount))
+            return false;
+        pos = next;
+        return true;
+    }
+
+    // Make a rename in file's directory durable.
+    template <typename T>
+    void Journal<T>::syncDirectory(const std::string &file)
+    {
+        std::string::size_type slash = file.rfind('/');
+        std::string directory = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : file.substr(0, slash));
+        int dir = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dir < 0)
+            fail("open " + directory);
+        if (::fsync(dir) != 0)
+        {
+            ::close(dir);
+            fail("fsync " + directory);
+        }
+        ::close(dir);
+    }
+
+    template <typename T>
+    void Journal<T>::writeHeader()
+    {
+        std::vector<char> header;
+        put(header, journal_magic);
+        put(header, static_cast<uint32_t>(sizeof(T)));
+        put(header, generation);
+        writeAll(fd, header.data(), header.size());
+        if (::fdatasync(fd) != 0)
+            fail("fsync " + path);
+    }
+
+    // The journal generation the snapshot includes, reading only its
+    // header (0 if there is no snapshot).
+    template <typename T>
+    uint64_t Journal<T>::snapshotGeneration() const
+    {
+        int in = ::open(snapshot_path.c_str(), O_RDONLY);
+        if (in < 0)
+            return 0;
+        char data[sizeof(uint32_t) * 2 + sizeof(uint64_t)];
+        ssize_t got = ::pread(in, data, sizeof(data), 0);
+        ::close(in);
+        if (got != static_cast<ssize_t>(sizeof(data)))
+            throw std::runtime_error("Snapshot " + snapshot_path + " is corrupt");
+        uint32_t magic, key_size;
+        uint64_t covers;
+        std::memcpy(&magic, data, sizeof(magic));
+        std::memcpy(&key_size, data + sizeof(magic), sizeof(key_size));
+        std::memcpy(&covers, data + sizeof(magic) + sizeof(key_size), sizeof(covers));
+        if (magic != snapshot_magic || key_size != sizeof(T))
+            throw std::runtime_error("Snapshot " + snapshot_path + " is corrupt");
+        return covers;
+    }
+
+    // Returns the journal generation the snapshot already includes (0 if
+    // there is no snapshot).
+    template <typename T>
+    uint64_t Journal<T>::readSnapshot(std::vector<std::pair<T, uint64_t> > &entries) const
+    {
+        std::vector<char> data;
+        entries.clear();
+        if (!readFile(snapshot_path, data))
+            return 0;
+
+        size_t pos = 0;
+        uint32_t magic = 0, key_size = 0;
+        uint64_t covers = 0, n = 0;
+        if (!get(data, pos, magic) || !get(data, pos, key_size) || !get(data, pos, covers) || !get(data, pos, n) ||
+            magic != snapshot_magic || key_size != sizeof(T))
+            throw std::runtime_error("Snapshot " + snapshot_path + " is corrupt");
+        if (n > (data.size() - pos) / (sizeof(T) + sizeof(uint64_t)))
+            throw std::runtime_error("Snapshot " + snapshot_path + " is truncated");
+        entries.resize(n);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            if (!get(data, pos, entries[i].first) || !get(data, pos, entries[i].second))
+                throw std::runtime_error("Snapshot " + snapshot_path + " is truncated");
+        }
+        return covers;
+    }
+
+    // Public Methods
+    template <typename T>
+    void Journal<T>::append(JournalOp op, const T &key, uint64_t amount)
+    {
+        buffer.push_back(static_cast<char>(op));
+        if (op != JournalOp::Clear)
+            put(buffer, key);
+        if (op == JournalOp::InsertMultiple || op == JournalOp::RemoveMultiple)
+            put(buffer, amount);
+        buffered_records++;
+
+        if (buffered_records >= commit_batch || std::chrono::steady_clock::now() - last_sync >= flush_interval)
+            sync();
+    }
+
+    template <typename T>
+    void Journal<T>::sync()
+    {
+        if (buffered_records > 0)
+        {
+            writeAll(fd, buffer.data(), buffer.size());
+            if (::fdatasync(fd) != 0)
+                fail("fsync " + path);
+            buffer.clear();
+            buffered_records = 0;
+        }
+        last_sync = std::chrono::steady_clock::now();
+    }
+
+    template <typename T>
+    size_t Journal<T>::pending() const
+    {
+        return buffered_records;
+    }
+
+    // Persist the set as a sorted (key, count) snapshot, then start a new
+    // journal generation. After a crash between the two steps the old
+    // journal's generation is covered by the snapshot: recover() skips its
+    // records and the next Journal on this path starts a new generation
+    // before appending.
+    template <typename T>
+    template <typename Augment, typename Storage, typename Balance>
+    void Journal<T>::checkpoint(const MultiSet<T, Augment, Storage, Balance> &set)
+    {
+        sync();
+
+        std::vector<char> data;
+        put(data, snapshot_magic);
+        put(data, static_cast<uint32_t>(sizeof(T)));
+        put(data, generation);
+        put(data, static_cast<uint64_t>(set.distinct_size()));
+        if (!set.empty())
+        {
+            for (typename MultiSet<T, Augment, Storage, Balance>::Finger f = set.finger(set.min()); f.valid(); f.next())
+            {
+                put(data, f.key());
+                put(data, static_cast<uint64_t>(f.count()));
+            }
+        }
+
+        std::string tmp_path = snapshot_path + ".tmp";
+        int out = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0)
+            fail("open " + tmp_path);
+        writeAll(out, data.data(), data.size());
+        if (::fsync(out) != 0)
+            fail("fsync " + tmp_path);
+        ::close(out);
+        if (::rename(tmp_path.c_str(), snapshot_path.c_str()) != 0)
+            fail("rename " + tmp_path);
+        syncDirectory(snapshot_path);
+
+        generation++;
+        if (::ftruncate(fd, 0) != 0)
+            fail("truncate " + path);
+        writeHeader();
+    }
+
+    // Rebuild `set` from the snapshot plus the journal records written after
+    // it, then attach this journal to the set. A torn record at the tail
+    // (crash mid-write) or an unknown op byte (corruption) ends the replay.
+    template <typename T>
+    template <typename Augment, typename Storage, typename Balance>
+    void Journal<T>::recover(MultiSet<T, Augment, Storage, Balance> &set)
+    {
+        sync();
+        std::vector<std::pair<T, uint64_t> > base;
+        uint64_t covers = readSnapshot(base);
+
+        // Fold records into absolute counts; removals clamp at zero exactly
+        // like MultiSet does, so order is preserved without touching a tree.
+        std::map<T, uint64_t> overlay;
+        bool cleared = false;
+        std::vector<char> data;
+        readFile(path, data);
+        size_t pos = 0;
+        uint32_t magic = 0, key_size = 0;
+        uint64_t journal_generation = 0;
+        if (get(data, pos, magic) && get(data, pos, key_size) && get(data, pos, journal_generation) &&
+            journal_generation > covers)
+        {
+            while (pos < data.size())
+            {
+                JournalOp op;
+                T key = T();
+                uint64_t amount = 1;
+                if (!readRecord(data, pos, op, key, amount))
+                    break;
+                if (op == JournalOp::Clear)
+                {
+                    cleared = true;
+                    overlay.clear();
+                    continue;
+                }
+
+                typename std::map<T, uint64_t>::iterator it = overlay.find(key);
+                if (it == overlay.end())
+                {
+                    uint64_t current = 0;
+                    if (!cleared)
+                    {
+                        typename std::vector<std::pair<T, uint64_t> >::const_iterator b =
+                            std::lower_bound(base.begin(), base.end(), std::make_pair(key, uint64_t(0)));
+                        if (b != base.end() && b->first == key)
+                            current = b->second;
+                    }
+                    it = overlay.insert(std::make_pair(key, current)).first;
+                }
+                switch (op)
+                {
+                case JournalOp::Insert:
+                case JournalOp::InsertMultiple:
+                    it->second += amount;
+                    break;
+                case JournalOp::Remove:
+                case JournalOp::RemoveMultiple:
+                    it->second -= std::min(amount, it->second);
+                    break;
+                case JournalOp::RemoveAll:
+                case JournalOp::Clear:
+                    it->second = 0;
+                    break;
+                }
+            }
+        }
+        if (cleared)
+            base.clear();
+
+        // Merge snapshot and overlay into sorted (key, count) runs; memory
+        // follows the distinct keys, not the total count
+        std::vector<std::pair<T, uint64_t> > runs;
+        runs.reserve(base.size() + overlay.size());
+        typename std::vector<std::pair<T, uint64_t> >::const_iterator b = base.begin();
+        typename std::map<T, uint64_t>::const_iterator o = overlay.begin();
+        while (b != base.end() || o != overlay.end())
+        {
+            const T *key;
+            uint64_t count;
+            if (o == overlay.end() || (b != base.end() && b->first < o->first))
+            {
+                key = &b->first;
+                count = b->second;
+                ++b;
+            }
+            else
+            {
+                if (b != base.end() && !(o->first < b->first))
+                    ++b;
+                key = &o->first;
+                count = o->second;
+                ++o;
+            }
+            if (count > 0)
+                runs.push_back(std::make_pair(*key, count));
+        }
+
+        set.attach_journal(nullptr);
+        set.assignRuns(runs);
+        set.attach_journal(this);
+    }
+
+} // namespace AVLTree
+
+#endif // JOURNAL_HPP
@@ -0,0 +1,465 @@
+#ifndef MAP_HPP
+#define MAP_HPP
+
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <iterator>
+#include <type_traits>
+#include "avl_core.hpp"
+
+namespace AVLTree
+{
+
+    template <typename K, typename V>
+    class Map
+    {
+    public:
+        typedef std::pair<const K, V> value_type;
+
+    private:
+        struct Node
+        {
+            value_type entry;
+            short height;
+            Node *left;
+            Node *right;
+            Node(const K &k, const V &v)
+                : entry(k, v), height(1), left(nullptr), right(nullptr) {}
+
+            static void refresh(Node *) {}
+        };
+
+        Node *root;
+        size_t entry_count;
+
+        Node *insert(Node *node, const K &key, const V &value, Node *&target, bool &inserted);
+        Node *remove(Node *node, const K &key, bool &removed);
+        Node *detachMin(Node *node, Node *&min);
+        Node *find(Node *node, const K &key) const;
+        void clear(Node *node);
+
+        // Forward in-order iterator. Nodes carry no parent pointer, so the
+        // iterator keeps the path from the root to the current node. Point
+        // lookups only record the node; the path is rebuilt on the first
+        // increment. Any insert or erase invalidates iterators.
+        template <typename Entry>
+        class Iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef typename Map::value_type value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef Entry *pointer;
+            typedef Entry &reference;
+
+            Iterator() : root(nullptr), node(nullptr) {}
+            // iterator -> const_iterator only; the reverse would hand out
+            // writable access to a const map.
+            template <typename Other>
+            Iterator(const Iterator<Other> &other,
+                     typename std::enable_if<std::is_convertible<Other *, Entry *>::value>::type * = nullptr)
+                : root(other.root), node(other.node), path(other.path) {}
+
+            reference operator*() const { return node->entry; }
+            pointer operator->() const { return &node->entry; }
+
+            Iterator &operator++()
+            {
+                if (path.empty())
+                    materialize();
+                if (node->right)
+                {
+                    path.push_back(node->right);
+                    descendLeft();
+                }
+                else
+                {
+                    Node *child;
+                    do
+                    {
+                        child = path.back();
+                        path.pop_back();
+                    } while (!path.empty() && path.back()->right == child);
+                }
+                node = path.empty() ? nullptr : path.back();
+                return *this;
+            }
+
+            Iterator operator++(int)
+            {
+                Iterator tmp(*this);
+                ++*this;
+                return tmp;
+            }
+
+            bool operator==(const Iterator &other) const { return node == other.node; }
+            bool operator!=(const Iterator &other) const { return node != other.node; }
+
+        private:
+            friend class Map;
+            template <typename>
+            friend class Iterator;
+
+            Node *root;
+            Node *node;
+            std::vector<Node *> path;
+
+            Iterator(Node *r, Node *n) : root(r), node(n) {}
+
+            void materialize()
+            {
+                Node *current = root;
+                while (current != node)
+                {
+                    path.push_back(current);
+                    current = (node->entry.first < current->entry.first) ? current->left : current->right;
+                }
+                path.push_back(node);
+            }
+
+            void descendLeft()
+            {
+                while (path.back()->left)
+                    path.push_back(path.back()->left);
+            }
+        };
+
+        template <typename It>
+        It first() const;
+        template <typename It>
+        It bound(const K &key, bool inclusive) const;
+
+    public:
+        typedef Iterator<value_type> iterator;
+        typedef Iterator<const value_type> const_iterator;
+
+        Map();
+        template <typename InputIt>
+        Map(InputIt begin, InputIt end);
+        ~Map();
+        V &operator[](const K &key);
+        V &at(const K &key);
+        const V &at(const K &key) const;
+        std::pair<iterator, bool> insert(const K &key, const V &value);
+        std::pair<iterator, bool> insert_or_assign(const K &key, const V &value);
+        size_t erase(const K &key);
+        iterator find(const K &key);
+        const_iterator find(const K &key) const;
+        bool contains(const K &key) const;
+        iterator lower_bound(const K &key);
+        const_iterator lower_bound(const K &key) const;
+        iterator upper_bound(const K &key);
+        const_iterator upper_bound(const K &key) const;
+        iterator begin();
+        const_iterator begin() const;
+        iterator end();
+        const_iterator end() const;
+        size_t size() const;
+        bool empty() const;
+        void clear();
+    };
+
+    // Constructor and Destructor
+    template <typename K, typename V>
+    Map<K, V>::Map() : root(nullptr), entry_count(0) {}
+
+    template <typename K, typename V>
+    template <typename InputIt>
+    Map<K, V>::Map(InputIt begin, InputIt end) : root(nullptr), entry_count(0)
+    {
+        for (InputIt it = begin; it != end; ++it)
+            insert_or_assign(it->first, it->second);
+    }
+
+    template <typename K, typename V>
+    Map<K, V>::~Map()
+    {
+        clear();
+    }
+
+    // Private Helper Methods
+    template <typename K, typename V>
+    typename Map<K, V>::Node *Map<K, V>::insert(Node *node, const K &key, const V &value, Node *&target, bool &inserted)
+    {
+        if (node == nullptr)
+        {
+            target = new Node(key, value);
+            inserted = true;
+            entry_count++;
+            return target;
+        }
+
+        if (key < node->entry.first)
+            node->left = insert(node->left, key, value, target, inserted);
+        else if (node->entry.first < key)
+            node->right = insert(node->right, key, value, target, inserted);
+        else
+        {
+            target = node;
+            return node;
+        }
+
+        // Nothing changed below an existing key, so the path needs no fixing.
+        if (!inserted)
+            return node;
+        return detail::rebalance(node);
+    }
+
+    // Unlink the leftmost node of the subtree and hand it back through `min`.
+    template <typename K, typename V>
+    typename Map<K, V>::Node *Map<K, V>::detachMin(Node *node, Node *&min)
+    {
+        if (node->left == nullptr)
+        {
+            min = node;
+            return node->right;
+        }
+        node->left = detachMin(node->left, min);
+        return detail::rebalance(node);
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::Node *Map<K, V>::remove(Node *node, const K &key, bool &removed)
+    {
+        if (node == nullptr)
+            return node;
+
+        if (key < node->entry.first)
+            node->left = remove(node->left, key, removed);
+        else if (node->entry.first < key)
+            node->right = remove(node->right, key, removed);
+        else
+        {
+            removed = true;
+            entry_count--;
+            Node *replacement;
+            if (node->left == nullptr || node->right == nullptr)
+            {
+                replacement = node->left ? node->left : node->right;
+            }
+            else
+            {
+                // Keys are const, so move the successor node into place
+                // instead of copying its entry.
+                Node *right = detachMin(node->right, replacement);
+                replacement->left = node->left;
+                replacement->right = right;
+            }
+            delete node;
+            if (replacement == nullptr)
+                return nullptr;
+            node = replacement;
+        }
+
+        if (!removed)
+            return node;
+        return detail::rebalance(node);
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::Node *Map<K, V>::find(Node *node, const K &key) const
+    {
+        while (node)
+        {
+            if (key < node->entry.first)
+                node = node->left;
+            else if (node->entry.first < key)
+                node = node->right;
+            else
+                return node;
+        }
+        return nullptr;
+    }
+
+    template <typename K, typename V>
+    void Map<K, V>::clear(Node *node)
+    {
+        if (node == nullptr)
+            return;
+        clear(node->left);
+        clear(node->right);
+        delete node;
+    }
+
+    template <typename K, typename V>
+    template <typename It>
+    It Map<K, V>::first() const
+    {
+        It it(root, root);
+        if (root)
+        {
+            it.path.push_back(root);
+            it.descendLeft();
+            it.node = it.path.back();
+        }
+        return it;
+    }
+
+    // Iterator to the first key >= key, or > key when not inclusive.
+    template <typename K, typename V>
+    template <typename It>
+    It Map<K, V>::bound(const K &key, bool inclusive) const
+    {
+        Node *ans = nullptr;
+        Node *node = root;
+        while (node)
+        {
+            if (inclusive ? !(node->entry.first < key) : key < node->entry.first)
+            {
+                ans = node;
+                node = node->left;
+            }
+            else
+            {
+                node = node->right;
+            }
+        }
+        return It(root, ans);
+    }
+
+    // Public Methods
+    template <typename K, typename V>
+    V &Map<K, V>::operator[](const K &key)
+    {
+        Node *target = nullptr;
+        bool inserted = false;
+        root = insert(root, key, V(), target, inserted);
+        return target->entry.second;
+    }
+
+    template <typename K, typename V>
+    V &Map<K, V>::at(const K &key)
+    {
+        Node *target = find(root, key);
+        if (target == nullptr)
+            throw std::out_of_range("Key not found");
+        return target->entry.second;
+    }
+
+    template <typename K, typename V>
+    const V &Map<K, V>::at(const K &key) const
+    {
+        Node *target = find(root, key);
+        if (target == nullptr)
+            throw std::out_of_range("Key not found");
+        return target->entry.second;
+    }
+
+    template <typename K, typename V>
+    std::pair<typename Map<K, V>::iterator, bool> Map<K, V>::insert(const K &key, const V &value)
+    {
+        Node *target = nullptr;
+        bool inserted = false;
+        root = insert(root, key, value, target, inserted);
+        return std::make_pair(iterator(root, target), inserted);
+    }
+
+    template <typename K, typename V>
+    std::pair<typename Map<K, V>::iterator, bool> Map<K, V>::insert_or_assign(const K &key, const V &value)
+    {
+        Node *target = nullptr;
+        bool inserted = false;
+        root = insert(root, key, value, target, inserted);
+        if (!inserted)
+            target->entry.second = value;
+        return std::make_pair(iterator(root, target), inserted);
+    }
+
+    template <typename K, typename V>
+    size_t Map<K, V>::erase(const K &key)
+    {
+        bool removed = false;
+        root = remove(root, key, removed);
+        return removed ? 1 : 0;
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::iterator Map<K, V>::find(const K &key)
+    {
+        return iterator(root, find(root, key));
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::const_iterator Map<K, V>::find(const K &key) const
+    {
+        return const_iterator(root, find(root, key));
+    }
+
+    template <typename K, typename V>
+    bool Map<K, V>::contains(const K &key) const
+    {
+        return find(root, key) != nullptr;
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::iterator Map<K, V>::lower_bound(const K &key)
+    {
+        return bound<iterator>(key, true);
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::const_iterator Map<K, V>::lower_bound(const K &key) const
+    {
+        return bound<const_iterator>(key, true);
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::iterator Map<K, V>::upper_bound(const K &key)
+    {
+        return bound<iterator>(key, false);
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::const_iterator Map<K, V>::upper_bound(const K &key) const
+    {
+        return bound<const_iterator>(key, false);
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::iterator Map<K, V>::begin()
+    {
+        return first<iterator>();
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::const_iterator Map<K, V>::begin() const
+    {
+        return first<const_iterator>();
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::iterator Map<K, V>::end()
+    {
+        return iterator();
+    }
+
+    template <typename K, typename V>
+    typename Map<K, V>::const_iterator Map<K, V>::end() const
+    {
+        return const_iterator();
+    }
+
+    template <typename K, typename V>
+    size_t Map<K, V>::size() const
+    {
+        return entry_count;
+    }
+
+    template <typename K, typename V>
+    bool Map<K, V>::empty() const
+    {
+        return entry_count == 0;
+    }
+
+    template <typename K, typename V>
+    void Map<K, V>::clear()
+    {
+        clear(root);
+        root = nullptr;
+        entry_count = 0;
+    }
+
+} // namespace AVLTree
+
+#endif // MAP_HPP
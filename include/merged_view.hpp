@@ -0,0 +1,218 @@
+#ifndef MERGED_VIEW_HPP
+#define MERGED_VIEW_HPP
+
+#include <vector>
+#include <algorithm>
+#include "multiset.hpp"
+
+namespace AVLTree
+{
+
+    // Read-only ordered view over several MultiSets, as if they were one.
+    //
+    // A Cursor keeps one Finger per tree and a min-heap of the fingers by
+    // key; each step pops every finger sitting on the smallest key, sums
+    // their counts and advances them. Nothing is materialized, so a scan
+    // that stops after m distinct keys costs O(m log k) heap work plus
+    // amortized O(1) finger steps, and lower_bound() costs O(k log n).
+    // Like fingers, cursors stop (become invalid) once a tree they read
+    // is modified: next() checks every finger first, O(k), and seek()
+    // restarts the cursor. The view only holds pointers, so trees must
+    // outlive it.
+    template <typename T, typename Augment = NoAugment, typename Storage = HeapStorage, typename Balance = AVLBalance>
+    class MergedView
+    {
+    public:
+        typedef MultiSet<T, Augment, Storage, Balance> Tree;
+
+        class Cursor
+        {
+        public:
+            bool valid() const { return has_current; }
+            const T &key() const { return current_key; }
+            size_t count() const { return current_count; }
+            bool next();
+            bool seek(const T &key);
+
+        private:
+            friend class MergedView;
+            typedef typename Tree::Finger Finger;
+
+            std::vector<Finger> fingers;
+            std::vector<size_t> heap; // indices into fingers, smallest key on top
+            T current_key;
+            size_t current_count;
+            bool has_current;
+
+            Cursor() : current_key(), current_count(0), has_current(false) {}
+
+            bool later(size_t a, size_t b) const { return fingers[b].key() < fingers[a].key(); }
+            bool stale() const;
+            void rebuildHeap();
+            void pushFinger(size_t index);
+            size_t popFinger();
+        };
+
+        MergedView();
+        explicit MergedView(const std::vector<const Tree *> &trees);
+        void add(const Tree &tree);
+        size_t tree_count() const;
+        Cursor begin() const;
+        Cursor lower_bound(const T &key) const;
+        size_t count(const T &key) const;
+        size_t size() const;
+        bool empty() const;
+
+    private:
+        std::vector<const Tree *> trees;
+    };
+
+    // Constructor
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    MergedView<T, Augment, Storage, Balance>::MergedView() {}
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    MergedView<T, Augment, Storage, Balance>::MergedView(const std::vector<const Tree *> &trees) : trees(trees) {}
+
+    // Private Helper Methods
+
+    // True if a tree under a queued finger changed; its path may point at
+    // freed nodes, so no finger in the heap may be read.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MergedView<T, Augment, Storage, Balance>::Cursor::stale() const
+    {
+        for (size_t i = 0; i < heap.size(); ++i)
+        {
+            if (!fingers[heap[i]].valid())
+                return true;
+        }
+        return false;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MergedView<T, Augment, Storage, Balance>::Cursor::pushFinger(size_t index)
+    {
+        heap.push_back(index);
+        std::push_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return later(a, b); });
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MergedView<T, Augment, Storage, Balance>::Cursor::popFinger()
+    {
+        std::pop_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return later(a, b); });
+        size_t index = heap.back();
+        heap.pop_back();
+        return index;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MergedView<T, Augment, Storage, Balance>::Cursor::rebuildHeap()
+    {
+        heap.clear();
+        for (size_t i = 0; i < fingers.size(); ++i)
+        {
+            if (fingers[i].valid())
+                heap.push_back(i);
+        }
+        std::make_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return later(a, b); });
+        next();
+    }
+
+    // Public Methods
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MergedView<T, Augment, Storage, Balance>::Cursor::next()
+    {
+        if (stale())
+            heap.clear();
+        if (heap.empty())
+        {
+            has_current = false;
+            return false;
+        }
+        size_t index = popFinger();
+        current_key = fingers[index].key();
+        current_count = 0;
+        while (true)
+        {
+            current_count += fingers[index].count();
+            if (fingers[index].next())
+                pushFinger(index);
+            if (heap.empty() || current_key < fingers[heap.front()].key())
+                break;
+            index = popFinger();
+        }
+        has_current = true;
+        return true;
+    }
+
+    // Move to the first key >= key in any tree.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MergedView<T, Augment, Storage, Balance>::Cursor::seek(const T &key)
+    {
+        for (size_t i = 0; i < fingers.size(); ++i)
+            fingers[i].seek(key);
+        rebuildHeap();
+        return has_current;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MergedView<T, Augment, Storage, Balance>::add(const Tree &tree)
+    {
+        trees.push_back(&tree);
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MergedView<T, Augment, Storage, Balance>::tree_count() const
+    {
+        return trees.size();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MergedView<T, Augment, Storage, Balance>::Cursor MergedView<T, Augment, Storage, Balance>::begin() const
+    {
+        Cursor cursor;
+        for (size_t i = 0; i < trees.size(); ++i)
+        {
+            cursor.fingers.push_back(trees[i]->empty() ? trees[i]->finger() : trees[i]->finger(trees[i]->min()));
+        }
+        cursor.rebuildHeap();
+        return cursor;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MergedView<T, Augment, Storage, Balance>::Cursor MergedView<T, Augment, Storage, Balance>::lower_bound(const T &key) const
+    {
+        Cursor cursor;
+        for (size_t i = 0; i < trees.size(); ++i)
+            cursor.fingers.push_back(trees[i]->finger(key));
+        cursor.rebuildHeap();
+        return cursor;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MergedView<T, Augment, Storage, Balance>::count(const T &key) const
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < trees.size(); ++i)
+            result += trees[i]->count(key);
+        return result;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MergedView<T, Augment, Storage, Balance>::size() const
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < trees.size(); ++i)
+            result += trees[i]->size();
+        return result;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MergedView<T, Augment, Storage, Balance>::empty() const
+    {
+        return size() == 0;
+    }
+
+} // namespace AVLTree
+
+#endif // MERGED_VIEW_HPP
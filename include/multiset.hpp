@@ -5,23 +5,188 @@
 #include <algorithm>
 #include <stdexcept>
 #include <iostream>
+#include <limits>
+#include <type_traits>
+#include <functional>
+#include <new>
+#include <cstdint>
+#include "avl_core.hpp"
+#include "trace.hpp"
+#include "hash_index.hpp"
 
 namespace AVLTree
 {
 
+    // Journaling lives in journal.hpp, which needs POSIX file I/O; a set
+    // only holds a pointer, so this header stays portable.
     template <typename T>
+    class Journal;
+
+    enum class JournalOp : unsigned char
+    {
+        Insert = 1,         // key
+        InsertMultiple = 2, // key, amount
+        Remove = 3,         // key
+        RemoveMultiple = 4, // key, amount
+        RemoveAll = 5,      // key
+        Clear = 6           // no payload
+    };
+
+    // Augmentation policies
+    //
+    // A policy describes a monoid that MultiSet maintains over every subtree:
+    //   value_type                    the summary type
+    //   identity()                    neutral element of combine
+    //   from(key, count)              summary of a single node
+    //   combine(a, b)                 associative; a covers keys before b
+    // The default NoAugment stores nothing and keeps the plain node layout.
+    struct NoAugment
+    {
+        typedef void value_type;
+    };
+
+    // Node placement used by MultiSet::compact().
+    enum class NodeLayout
+    {
+        InOrder,     // slot order follows key order; best for scans
+        VanEmdeBoas  // recursive top/bottom blocking; best for lookups
+    };
+
+    // Which end a bounded MultiSet gives up when it overflows: Max keeps
+    // the smallest values, Min keeps the largest.
+    enum class Evict
+    {
+        Max,
+        Min
+    };
+
+    struct MemoryUsage
+    {
+        size_t node_bytes;        // sizeof(Node) for every node in the tree
+        size_t allocator_slack;   // estimated malloc overhead plus unused arena slots
+        size_t bookkeeping_bytes; // side structures such as the purge queue
+        size_t bulk_peak_bytes;   // largest temporary footprint of a bulk insert or compact
+        size_t total() const { return node_bytes + allocator_slack + bookkeeping_bytes; }
+    };
+
+    // Storage policies
+    //
+    // A policy supplies `template <typename Node> class pool` with:
+    //   allocate()                    memory for one node; throws when full
+    //   deallocate(p)                 give one node's memory back
+    //   allocate_block(n)             contiguous memory for n nodes (compact)
+    //   deallocate_block(p, n)        release a block from allocate_block
+    //   bounded, capacity()           whether capacity() is a hard node limit
+    // HeapStorage is plain operator new/delete; InlineStorage<N> lives in
+    // static_multiset.hpp.
+    struct HeapStorage
+    {
+        template <typename Node>
+        class pool
+        {
+        public:
+            static const bool bounded = false;
+            size_t capacity() const { return std::numeric_limits<size_t>::max(); }
+            void *allocate() { return ::operator new(sizeof(Node)); }
+            void deallocate(void *p) { ::operator delete(p); }
+            void *allocate_block(size_t n) { return ::operator new(n * sizeof(Node)); }
+            void deallocate_block(void *p, size_t) { ::operator delete(p); }
+        };
+    };
+
+    namespace detail
+    {
+        // Bytes glibc's malloc actually reserves for a request: an 8-byte
+        // header, rounded up to 16 with a 32-byte minimum chunk.
+        inline size_t mallocChunkSize(size_t bytes)
+        {
+            size_t chunk = (bytes + 8 + 15) & ~static_cast<size_t>(15);
+            return chunk < 32 ? 32 : chunk;
+        }
+    } // namespace detail
+
+    template <typename T>
+    struct SumAugment
+    {
+        typedef T value_type;
+        static value_type identity() { return T(); }
+        static value_type from(const T &key, size_t count) { return key * static_cast<T>(count); }
+        static value_type combine(const value_type &a, const value_type &b) { return a + b; }
+    };
+
+    template <typename T>
+    struct MinAugment
+    {
+        typedef T value_type;
+        static value_type identity() { return std::numeric_limits<T>::max(); }
+        static value_type from(const T &key, size_t count) { return count ? key : identity(); }
+        static value_type combine(const value_type &a, const value_type &b) { return b < a ? b : a; }
+    };
+
+    template <typename T>
+    struct MaxAugment
+    {
+        typedef T value_type;
+        static value_type identity() { return std::numeric_limits<T>::lowest(); }
+        static value_type from(const T &key, size_t count) { return count ? key : identity(); }
+        static value_type combine(const value_type &a, const value_type &b) { return a < b ? b : a; }
+    };
+
+    namespace detail
+    {
+        // Per-node summary storage. Node derives from this, so the empty
+        // NoAugment specialization costs nothing (empty base optimization).
+        template <typename Augment>
+        struct NodeSummary
+        {
+            typename Augment::value_type summary;
+
+            NodeSummary() : summary(Augment::identity()) {}
+
+            template <typename Node>
+            static void refresh(Node *node)
+            {
+                typename Augment::value_type s = Augment::from(node->key, node->count);
+                if (node->left)
+                    s = Augment::combine(node->left->summary, s);
+                if (node->right)
+                    s = Augment::combine(s, node->right->summary);
+                node->summary = s;
+            }
+        };
+
+        template <>
+        struct NodeSummary<NoAugment>
+        {
+            template <typename Node>
+            static void refresh(Node *) {}
+        };
+    } // namespace detail
+
+    template <typename T, typename Augment = NoAugment, typename Storage = HeapStorage, typename Balance = AVLBalance>
     class MultiSet
     {
+    public:
+        typedef typename Augment::value_type summary_type;
+
     private:
-        struct Node
+        struct Node : detail::NodeSummary<Augment>
         {
             T key;
             short height;
+            bool has_live; // some node in this subtree is not a tombstone
             size_t count;
             Node *left;
             Node *right;
             Node(const T &k, size_t cnt = 1)
-                : key(k), height(1), count(cnt), left(nullptr), right(nullptr) {}
+                : key(k), height(1), has_live(cnt > 0), count(cnt), left(nullptr), right(nullptr) {}
+
+            static void refresh(Node *node)
+            {
+                detail::NodeSummary<Augment>::refresh(node);
+                node->has_live = node->count > 0 || (node->left && node->left->has_live) ||
+                                 (node->right && node->right->has_live);
+            }
         };
 
         Node *root;
@@ -29,23 +194,178 @@ namespace AVLTree
         Node *max_node;
         size_t distinct_count;
         size_t total_count;
+        // Bumped on every structural change; fingers taken at an older
+        // version restart their search from the root.
+        unsigned long version;
+        static const bool augmented = !std::is_same<Augment, NoAugment>::value;
+
+        // Contiguous node storage filled by compact(). Nodes freed from it are
+        // recycled before falling back to the heap.
+        Node *arena;
+        size_t arena_capacity;
+        size_t arena_used;
+        std::vector<Node *> arena_free;
+        size_t bulk_peak_bytes;
+
+        // Lazy deletion: nodes whose count drops to zero stay in the tree as
+        // tombstones and are purged a few at a time once they pile up.
+        static const size_t compact_batch = 4;
+        bool lazy_deletion;
+        bool compacting;
+        double compact_threshold;
+        size_t tombstone_count;
+        std::vector<T> pending_purge;
+
+        // Optional write-ahead log; every logical mutation is recorded.
+        // Appends go through journal_append, bound by attach_journal(), so
+        // only code that attaches a journal needs its definition.
+        Journal<T> *journal;
+        void (*journal_append)(Journal<T> *, JournalOp, const T &, uint64_t);
+
+        typedef typename Storage::template pool<Node> Pool;
+        Pool node_pool;
+
+        // Write buffering: point updates are coalesced into a sorted
+        // per-key delta log and applied in key order once it fills or a
+        // read needs the tree itself. Removals are clamped against the
+        // merged count when buffered, so every delta is exact.
+        size_t write_buffer_capacity;
+        std::vector<std::pair<T, long long> > write_buffer;
+        long long buffered_total;
+
+        // Optional operation trace. Only the outermost public call is
+        // recorded; calls it makes on the tree itself (pop_min's remove,
+        // a flush's inserts) run with trace_depth raised. Untraced sets
+        // never touch trace_depth.
+        TraceRecorder<T> *trace;
+        mutable unsigned trace_depth;
+
+        // Bounded (top-K) mode: at most bound_capacity values are kept.
+        // The cached min_node/max_node is the boundary, so a full set
+        // rejects worse keys with one comparison.
+        size_t bound_capacity;
+        Evict bound_side;
+
+        // Optional hash side index from key to node for point queries.
+        // Maintained wherever nodes are created, destroyed or re-keyed;
+        // tombstones stay indexed like any other node.
+        detail::SwissIndex<T, Node *> hash_index;
+        bool hash_indexed;
+
+        class TraceScope
+        {
+        public:
+            explicit TraceScope(const MultiSet *tree) : owner(tree->trace ? tree : nullptr)
+            {
+                if (owner)
+                    owner->trace_depth++;
+            }
+            TraceScope(const MultiSet *tree, TraceOp op, const T &key = T(), uint64_t amount = 1)
+                : owner(tree->trace ? tree : nullptr)
+            {
+                if (owner == nullptr)
+                    return;
+                if (owner->trace_depth == 0)
+                    owner->trace->record(op, key, amount);
+                owner->trace_depth++;
+            }
+            ~TraceScope()
+            {
+                if (owner)
+                    owner->trace_depth--;
+            }
 
-        short height(Node *node) const;
-        Node *buildFromSorted(const std::vector<T> &keys, size_t start, size_t end);
-        int getBalance(Node *node) const;
-        Node *rotateRight(Node *y);
-        Node *rotateLeft(Node *x);
+        private:
+            const MultiSet *owner;
+        };
+
+        Node *createNode(const T &key, size_t count);
+        void destroyNode(Node *node);
+        bool inArena(const Node *node) const;
+        void releaseArena();
+        Node *buildFromSorted(const std::vector<T> &keys, const std::vector<size_t> &runs, size_t lo, size_t hi);
+        Node *buildFromRuns(const std::vector<std::pair<T, uint64_t> > &entries, size_t lo, size_t hi);
+        void assignRuns(const std::vector<std::pair<T, uint64_t> > &entries);
+        Node *buildCompact(const std::vector<Node *> &nodes, size_t lo, size_t hi,
+                           const std::vector<size_t> &slot, Node *storage);
+        void vebOrder(size_t lo, size_t hi, int levels, std::vector<size_t> &order) const;
+        void collectLive(Node *node, std::vector<Node *> &nodes) const;
         Node *insert(Node *node, const T &key, size_t amount);
         Node *getMinNode(Node *node) const;
         Node *getMaxNode(Node *node) const;
+        Node *getLiveMinNode(Node *node) const;
+        Node *getLiveMaxNode(Node *node) const;
         void updateMinNode();
         void updateMaxNode();
         Node *remove(Node *node, const T &key, size_t amount);
         void clear(Node *node);
         Node *lower_bound(Node *node, const T &key) const;
+        Node *findNode(const T &key) const;
+        bool addToExisting(const T &key, size_t amount);
+        void rebuildIndex();
         void inorder(Node *node, std::vector<T> &result) const;
+        void refreshPath(Node *node, const T &key);
+        void removeLazily(Node *node, size_t amount);
+        void compactStep();
+        void reset();
+        typename std::vector<std::pair<T, long long> >::iterator bufferEntry(const T &key) const;
+        void bufferDelta(const T &key, long long delta);
+        void drainBuffer() const;
+        bool outOfBound(const T &key) const;
+        void insertBounded(const T &key, size_t amount);
+        void makeRoom(const T &key, size_t amount);
+        void evictOverflow();
+        void appendJournal(JournalOp op, const T &key, uint64_t amount = 1);
+        static void forwardJournal(Journal<T> *journal, JournalOp op, const T &key, uint64_t amount);
+
+        template <typename>
+        friend class Journal;
+        summary_type summary(Node *node) const;
+        summary_type aggregateFrom(Node *node, const T &lo) const;
+        summary_type aggregateTo(Node *node, const T &hi) const;
 
     public:
+        // Cursor that remembers the root path to its last position, so the
+        // next search only climbs to the smallest subtree that can contain
+        // the new key: O(log d) for a target d keys away in the common case.
+        // Positions are distinct keys, tombstones are skipped.
+        class Finger
+        {
+        public:
+            Finger() : tree(nullptr), version(0) {}
+
+            // Move to the first key >= key; returns true if key is present.
+            bool seek(const T &key);
+            bool next();
+            bool prev();
+            bool valid() const { return !path.empty() && version == tree->version; }
+            const T &key() const { return path.back().node->key; }
+            size_t count() const { return path.back().node->count; }
+
+        private:
+            friend class MultiSet;
+
+            // lo/hi index the nearest ancestors bounding this subtree from
+            // below/above (-1 when unbounded).
+            struct Frame
+            {
+                Node *node;
+                int lo;
+                int hi;
+            };
+
+            const MultiSet *tree;
+            unsigned long version;
+            std::vector<Frame> path;
+
+            explicit Finger(const MultiSet *t) : tree(t), version(t->version) {}
+
+            void push(Node *node, bool left_child);
+            int descend(const T &target);
+            void step(bool forward);
+            void skipTombstones(bool forward);
+        };
+
         MultiSet();
         template <typename Iterator>
         MultiSet(Iterator begin, Iterator end);
@@ -54,6 +374,9 @@ namespace AVLTree
         void insert(Iterator begin, Iterator end);
         void insert(const T &key);
         void insert_multiple(const T &key, size_t amount);
+        void insert(Finger &hint, const T &key);
+        Finger finger() const;
+        Finger finger(const T &key) const;
         void remove(const T &key);
         void remove_multiple(const T &key, size_t amount);
         void remove_all(const T &key);
@@ -66,159 +389,265 @@ namespace AVLTree
         size_t size() const;
         bool empty() const;
         size_t distinct_size() const;
+        size_t tombstone_size() const;
+        MemoryUsage memory_usage() const;
+        void compact(NodeLayout layout = NodeLayout::VanEmdeBoas);
+        void set_lazy_deletion(bool enabled, double threshold = 0.25);
+        void set_write_buffer(size_t capacity);
+        void flush();
+        void set_bound(size_t capacity, Evict side = Evict::Max);
+        size_t bound() const;
+        void set_hash_index(bool enabled);
+        void attach_journal(Journal<T> *journal);
+        void attach_trace(TraceRecorder<T> *trace);
         void clear();
         std::vector<T> to_vector() const;
+        summary_type aggregate(const T &lo, const T &hi) const;
+        summary_type aggregate() const;
     };
 
     // Constructor and Destructor
-    template <typename T>
-    MultiSet<T>::MultiSet() : root(nullptr), min_node(nullptr), max_node(nullptr), distinct_count(0), total_count(0) {}
-
-    template <typename T>
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    MultiSet<T, Augment, Storage, Balance>::MultiSet()
+        : root(nullptr), min_node(nullptr), max_node(nullptr), distinct_count(0), total_count(0), version(0),
+          arena(nullptr), arena_capacity(0), arena_used(0), bulk_peak_bytes(0),
+          lazy_deletion(false), compacting(false), compact_threshold(0.25), tombstone_count(0),
+          journal(nullptr), journal_append(nullptr), write_buffer_capacity(0), buffered_total(0), trace(nullptr), trace_depth(0),
+          bound_capacity(0), bound_side(Evict::Max), hash_indexed(false) {}
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
     template <typename Iterator>
-    MultiSet<T>::MultiSet(Iterator begin, Iterator end) : root(nullptr), min_node(nullptr), max_node(nullptr), distinct_count(0), total_count(0)
+    MultiSet<T, Augment, Storage, Balance>::MultiSet(Iterator begin, Iterator end)
+        : root(nullptr), min_node(nullptr), max_node(nullptr), distinct_count(0), total_count(0), version(0),
+          arena(nullptr), arena_capacity(0), arena_used(0), bulk_peak_bytes(0),
+          lazy_deletion(false), compacting(false), compact_threshold(0.25), tombstone_count(0),
+          journal(nullptr), journal_append(nullptr), write_buffer_capacity(0), buffered_total(0), trace(nullptr), trace_depth(0),
+          bound_capacity(0), bound_side(Evict::Max), hash_indexed(false)
     {
         insert(begin, end);
     }
 
-    template <typename T>
-    MultiSet<T>::~MultiSet()
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    MultiSet<T, Augment, Storage, Balance>::~MultiSet()
     {
-        clear();
+        reset();
     }
 
     // Private Helper Methods
-    template <typename T>
-    short MultiSet<T>::height(Node *node) const
-    {
-        return (node == nullptr) ? 0 : node->height;
-    }
-
-    template <typename T>
-    typename MultiSet<T>::Node *MultiSet<T>::buildFromSorted(const std::vector<T> &keys, size_t start, size_t end)
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::createNode(const T &key, size_t count)
     {
-        if (start > end || start >= keys.size() || end >= keys.size())
-            return nullptr;
-
-        // Calculate the middle index
-        size_t mid = start + (end - start) / 2;
-
-        // Count duplicates around the middle element
-        size_t count = 1;
-
-        // Count duplicates to the left
-        size_t left_idx = mid;
-        while (left_idx > start && left_idx < end && keys[left_idx - 1] == keys[mid])
+        Node *node;
+        if (arena_free.empty())
         {
-            count++;
-            if (left_idx == 0)
-                break;
-            left_idx--;
+            void *memory = node_pool.allocate();
+            try
+            {
+                node = new (memory) Node(key, count);
+            }
+            catch (...)
+            {
+                node_pool.deallocate(memory);
+                throw;
+            }
+        }
+        else
+        {
+            node = new (arena_free.back()) Node(key, count);
+            arena_free.pop_back();
+            arena_used++;
+        }
+        if (hash_indexed)
+        {
+            try
+            {
+                hash_index.insert(key, node);
+            }
+            catch (...)
+            {
+                destroyNode(node);
+                throw;
+            }
         }
+        return node;
+    }
 
-        // Count duplicates to the right
-        size_t right_idx = mid;
-        while (right_idx < end && keys[right_idx + 1] == keys[mid])
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::destroyNode(Node *node)
+    {
+        if (hash_indexed)
+            hash_index.erase(node->key, node);
+        node->~Node();
+        if (!inArena(node))
         {
-            count++;
-            right_idx++;
+            node_pool.deallocate(node);
+            return;
         }
+        arena_free.push_back(node);
+        arena_used--;
+    }
 
-        // Create a new node with the middle element and its count
-        Node *node = new Node(keys[mid], count);
-        distinct_count++;
-        total_count += count;
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MultiSet<T, Augment, Storage, Balance>::inArena(const Node *node) const
+    {
+        std::less<const Node *> before;
+        return arena != nullptr && !before(node, arena) && before(node, arena + arena_capacity);
+    }
 
-        // Recursively build left and right subtrees
-        // Skip the duplicates when recursing
-        if (left_idx > start && left_idx < end) // Check to prevent underflow
-            node->left = buildFromSorted(keys, start, left_idx - 1);
-        if (right_idx < end) // Build right subtree
-            node->right = buildFromSorted(keys, right_idx + 1, end);
+    // Only valid once every arena node has been destroyed.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::releaseArena()
+    {
+        if (arena)
+            node_pool.deallocate_block(arena, arena_capacity);
+        arena = nullptr;
+        arena_capacity = 0;
+        arena_used = 0;
+        arena_free.clear();
+        std::vector<Node *>().swap(arena_free);
+    }
 
-        node->height = 1 + std::max(height(node->left), height(node->right));
+    // Copy nodes[lo, hi) into storage as a balanced subtree, placing the
+    // i-th node at storage[slot[i]].
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::buildCompact(const std::vector<Node *> &nodes, size_t lo, size_t hi,
+                                                                            const std::vector<size_t> &slot, Node *storage)
+    {
+        if (lo >= hi)
+            return nullptr;
+        size_t mid = lo + (hi - lo) / 2;
+        Node *node = new (storage + slot[mid]) Node(nodes[mid]->key, nodes[mid]->count);
+        node->left = buildCompact(nodes, lo, mid, slot, storage);
+        node->right = buildCompact(nodes, mid + 1, hi, slot, storage);
+        detail::updateNode(node);
+        return node;
+    }
 
-        // Check balance factor and rotate if necessary
-        int balance = getBalance(node);
-        // Left Left Case
-        if (balance > 1 && getBalance(node->left) >= 0)
-            node = rotateRight(node);
-        // Right Right Case
-        else if (balance < -1 && getBalance(node->right) <= 0)
-            node = rotateLeft(node);
-        // Left Right Case
-        else if (balance > 1 && getBalance(node->left) < 0)
+    // Append the van Emde Boas order of the balanced subtree over [lo, hi),
+    // truncated to its top `levels` levels: the top half of the levels is
+    // laid out first, then each subtree hanging below it.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::vebOrder(size_t lo, size_t hi, int levels, std::vector<size_t> &order) const
+    {
+        if (lo >= hi || levels <= 0)
+            return;
+        size_t mid = lo + (hi - lo) / 2;
+        if (levels == 1)
         {
-            node->left = rotateLeft(node->left);
-            node = rotateRight(node);
+            order.push_back(mid);
+            return;
         }
-        // Right Left Case
-        else if (balance < -1 && getBalance(node->right) > 0)
+        int top = levels / 2;
+        vebOrder(lo, hi, top, order);
+
+        // Subtrees rooted `top` levels down, left to right
+        std::vector<std::pair<size_t, size_t> > ranges(1, std::make_pair(lo, hi));
+        for (int depth = 0; depth < top; ++depth)
         {
-            node->right = rotateRight(node->right);
-            node = rotateLeft(node);
+            std::vector<std::pair<size_t, size_t> > next;
+            for (size_t i = 0; i < ranges.size(); ++i)
+            {
+                size_t a = ranges[i].first, b = ranges[i].second;
+                if (a >= b)
+                    continue;
+                size_t m = a + (b - a) / 2;
+                next.push_back(std::make_pair(a, m));
+                next.push_back(std::make_pair(m + 1, b));
+            }
+            ranges.swap(next);
         }
-
-        return node;
+        for (size_t i = 0; i < ranges.size(); ++i)
+            vebOrder(ranges[i].first, ranges[i].second, levels - top, order);
     }
 
-    template <typename T>
-    int MultiSet<T>::getBalance(Node *node) const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::collectLive(Node *node, std::vector<Node *> &nodes) const
     {
-        return (node == nullptr) ? 0 : height(node->left) - height(node->right);
+        if (node == nullptr)
+            return;
+        collectLive(node->left, nodes);
+        if (node->count > 0)
+            nodes.push_back(node);
+        collectLive(node->right, nodes);
     }
 
-    template <typename T>
-    typename MultiSet<T>::Node *MultiSet<T>::rotateRight(Node *y)
+    // Build runs [lo, hi) split by distinct key, so the tree is perfectly
+    // balanced however the duplicates fall and its heights are valid ranks
+    // under every balancing policy.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::buildFromSorted(const std::vector<T> &keys, const std::vector<size_t> &runs, size_t lo, size_t hi)
     {
-        Node *x = y->left;
-        Node *T2 = x->right;
+        if (lo >= hi)
+            return nullptr;
 
-        x->right = y;
-        y->left = T2;
+        size_t mid = lo + (hi - lo) / 2;
+        size_t count = runs[mid + 1] - runs[mid];
+        Node *node = createNode(keys[runs[mid]], count);
+        distinct_count++;
+        total_count += count;
 
-        y->height = 1 + std::max(height(y->left), height(y->right));
-        x->height = 1 + std::max(height(x->left), height(x->right));
+        node->left = buildFromSorted(keys, runs, lo, mid);
+        node->right = buildFromSorted(keys, runs, mid + 1, hi);
+        detail::updateNode(node);
 
-        return x;
+        return node;
     }
 
-    template <typename T>
-    typename MultiSet<T>::Node *MultiSet<T>::rotateLeft(Node *x)
+    // Same shape from (key, count) runs, so counts are never expanded.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::buildFromRuns(const std::vector<std::pair<T, uint64_t> > &entries, size_t lo, size_t hi)
     {
-        Node *y = x->right;
-        Node *T2 = y->left;
+        if (lo >= hi)
+            return nullptr;
 
-        y->left = x;
-        x->right = T2;
+        size_t mid = lo + (hi - lo) / 2;
+        Node *node = createNode(entries[mid].first, entries[mid].second);
+        distinct_count++;
+        total_count += entries[mid].second;
 
-        x->height = 1 + std::max(height(x->left), height(x->right));
-        y->height = 1 + std::max(height(y->left), height(y->right));
+        node->left = buildFromRuns(entries, lo, mid);
+        node->right = buildFromRuns(entries, mid + 1, hi);
+        detail::updateNode(node);
 
-        return y;
+        return node;
     }
 
-    template <typename T>
-    typename MultiSet<T>::Node *MultiSet<T>::insert(Node *node, const T &key, size_t amount)
+    // Replace the contents with sorted runs of positive counts, without
+    // journaling; Journal::recover() rebuilds through this. A bound still
+    // applies.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::assignRuns(const std::vector<std::pair<T, uint64_t> > &entries)
+    {
+        if (Pool::bounded && entries.size() > node_pool.capacity())
+            throw std::length_error("Node capacity exceeded");
+        write_buffer.clear();
+        buffered_total = 0;
+        reset();
+        if (hash_indexed)
+            hash_index.reserve(entries.size());
+        root = buildFromRuns(entries, 0, entries.size());
+        updateMinNode();
+        updateMaxNode();
+        if (bound_capacity)
+            evictOverflow();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::insert(Node *node, const T &key, size_t amount)
     {
         if (node == nullptr)
         {
-            Node *newNode = new Node(key, amount);
+            Node *newNode = createNode(key, amount);
+            Node::refresh(newNode);
             distinct_count++;
+            version++;
             total_count += amount;
 
             // Update min_node and max_node when creating a new node
-            if (root == nullptr)
-            {
-                min_node = max_node = newNode;
-            }
-            else
-            {
-                if (key < min_node->key)
-                    min_node = newNode;
-                if (key > max_node->key)
-                    max_node = newNode;
-            }
+            if (min_node == nullptr || key < min_node->key)
+                min_node = newNode;
+            if (max_node == nullptr || key > max_node->key)
+                max_node = newNode;
             return newNode;
         }
 
@@ -228,28 +657,22 @@ namespace AVLTree
             node->right = insert(node->right, key, amount);
         else
         {
+            if (node->count == 0)
+            {
+                // Reviving a tombstone
+                tombstone_count--;
+                if (min_node == nullptr || key < min_node->key)
+                    min_node = node;
+                if (max_node == nullptr || key > max_node->key)
+                    max_node = node;
+            }
             node->count += amount;
             total_count += amount;
+            Node::refresh(node);
             return node;
         }
 
-        node->height = 1 + std::max(height(node->left), height(node->right));
-        int balance = getBalance(node);
-
-        if (balance > 1 && key < node->left->key)
-            node = rotateRight(node);
-        else if (balance < -1 && key > node->right->key)
-            node = rotateLeft(node);
-        else if (balance > 1 && key > node->left->key)
-        {
-            node->left = rotateLeft(node->left);
-            node = rotateRight(node);
-        }
-        else if (balance < -1 && key < node->right->key)
-        {
-            node->right = rotateRight(node->right);
-            node = rotateLeft(node);
-        }
+        node = Balance::rebalance(node);
 
         // If the node was previously min or max and was rotated,
         // we need to update the cached pointers
@@ -261,8 +684,8 @@ namespace AVLTree
         return node;
     }
 
-    template <typename T>
-    typename MultiSet<T>::Node *MultiSet<T>::remove(Node *node, const T &key, size_t amount)
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::remove(Node *node, const T &key, size_t amount)
     {
         if (node == nullptr)
             return node;
@@ -280,6 +703,7 @@ namespace AVLTree
                 // Only remove part of the count.
                 node->count -= amount;
                 total_count -= amount;
+                Node::refresh(node);
                 return node;
             }
             else
@@ -291,11 +715,12 @@ namespace AVLTree
                 {
                     total_count -= node->count;
                     distinct_count--;
+                    version++;
                     Node *temp = node->left ? node->left : node->right;
                     if (temp == nullptr)
                     {
                         // No children: free the node and return nullptr.
-                        delete node;
+                        destroyNode(node);
                         return nullptr;
                     }
                     else
@@ -303,7 +728,7 @@ namespace AVLTree
                         // One child: replace node with its child.
                         Node *oldNode = node;
                         node = temp;
-                        delete oldNode;
+                        destroyNode(oldNode);
                     }
                 }
                 // Case 2: node has two children.
@@ -314,8 +739,12 @@ namespace AVLTree
                     // Adjust total_count:
                     total_count = total_count + temp->count - node->count;
                     // Copy the successor's data to the current node.
+                    if (hash_indexed)
+                        hash_index.erase(node->key, node);
                     node->key = temp->key;
                     node->count = temp->count;
+                    if (hash_indexed)
+                        hash_index.insert(node->key, node); // overwrites the successor's entry
                     // Remove the inorder successor.
                     node->right = remove(node->right, temp->key, temp->count);
                 }
@@ -325,34 +754,14 @@ namespace AVLTree
         if (node == nullptr)
             return node;
 
-        node->height = 1 + std::max(height(node->left), height(node->right));
-        int balance = getBalance(node);
-
         // Rebalance if needed.
-        // Left Left Case
-        if (balance > 1 && getBalance(node->left) >= 0)
-            node = rotateRight(node);
-        // Right Right Case
-        else if (balance < -1 && getBalance(node->right) <= 0)
-            node = rotateLeft(node);
-        // Left Right Case
-        else if (balance > 1 && getBalance(node->left) < 0)
-        {
-            node->left = rotateLeft(node->left);
-            node = rotateRight(node);
-        }
-        // Right Left Case
-        else if (balance < -1 && getBalance(node->right) > 0)
-        {
-            node->right = rotateRight(node->right);
-            node = rotateLeft(node);
-        }
+        node = Balance::rebalance(node);
 
         return node;
     }
 
-    template <typename T>
-    typename MultiSet<T>::Node *MultiSet<T>::getMinNode(Node *node) const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::getMinNode(Node *node) const
     {
         Node *current = node;
         while (current->left != nullptr)
@@ -360,8 +769,8 @@ namespace AVLTree
         return current;
     }
 
-    template <typename T>
-    typename MultiSet<T>::Node *MultiSet<T>::getMaxNode(Node *node) const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::getMaxNode(Node *node) const
     {
         Node *current = node;
         while (current->right != nullptr)
@@ -369,20 +778,60 @@ namespace AVLTree
         return current;
     }
 
-    template <typename T>
-    void MultiSet<T>::updateMinNode()
+    // Leftmost node that is not a tombstone. has_live steers the descent
+    // past all-tombstone subtrees, so this is O(log n).
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::getLiveMinNode(Node *node) const
+    {
+        if (node == nullptr || !node->has_live)
+            return nullptr;
+        while (true)
+        {
+            if (node->left && node->left->has_live)
+                node = node->left;
+            else if (node->count > 0)
+                return node;
+            else
+                node = node->right;
+        }
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::getLiveMaxNode(Node *node) const
     {
-        min_node = (root == nullptr) ? nullptr : getMinNode(root);
+        if (node == nullptr || !node->has_live)
+            return nullptr;
+        while (true)
+        {
+            if (node->right && node->right->has_live)
+                node = node->right;
+            else if (node->count > 0)
+                return node;
+            else
+                node = node->left;
+        }
     }
 
-    template <typename T>
-    void MultiSet<T>::updateMaxNode()
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::updateMinNode()
     {
-        max_node = (root == nullptr) ? nullptr : getMaxNode(root);
+        if (tombstone_count > 0)
+            min_node = getLiveMinNode(root);
+        else
+            min_node = (root == nullptr) ? nullptr : getMinNode(root);
     }
 
-    template <typename T>
-    typename MultiSet<T>::Node *MultiSet<T>::lower_bound(Node *node, const T &key) const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::updateMaxNode()
+    {
+        if (tombstone_count > 0)
+            max_node = getLiveMaxNode(root);
+        else
+            max_node = (root == nullptr) ? nullptr : getMaxNode(root);
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::lower_bound(Node *node, const T &key) const
     {
         Node *ans = nullptr;
         while (node)
@@ -400,18 +849,64 @@ namespace AVLTree
         return ans;
     }
 
-    template <typename T>
-    void MultiSet<T>::clear(Node *node)
+    // The node holding exactly key (possibly a tombstone), or nullptr.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Node *MultiSet<T, Augment, Storage, Balance>::findNode(const T &key) const
+    {
+        if (hash_indexed)
+            return hash_index.find(key);
+        Node *node = lower_bound(root, key);
+        return (node != nullptr && node->key == key) ? node : nullptr;
+    }
+
+    // With the hash index, a key already present gains its copies in place
+    // without a descent. Summaries along the path would need a descent
+    // anyway, and a tombstone revival moves min/max, so those decline.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MultiSet<T, Augment, Storage, Balance>::addToExisting(const T &key, size_t amount)
+    {
+        if (!hash_indexed || augmented)
+            return false;
+        Node *node = hash_index.find(key);
+        if (node == nullptr || node->count == 0)
+            return false;
+        node->count += amount;
+        total_count += amount;
+        return true;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::rebuildIndex()
+    {
+        hash_index.clear();
+        if (!hash_indexed || root == nullptr)
+            return;
+        hash_index.reserve(distinct_count);
+        std::vector<Node *> stack(1, root);
+        while (!stack.empty())
+        {
+            Node *node = stack.back();
+            stack.pop_back();
+            hash_index.insert(node->key, node);
+            if (node->left)
+                stack.push_back(node->left);
+            if (node->right)
+                stack.push_back(node->right);
+        }
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::clear(Node *node)
     {
         if (node == nullptr)
             return;
         clear(node->left);
         clear(node->right);
-        delete node;
+        destroyNode(node);
     }
 
-    template <typename T>
-    void MultiSet<T>::inorder(Node *node, std::vector<T> &result) const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::inorder(Node *node, std::vector<T> &result) const
     {
         if (node)
         {
@@ -424,128 +919,810 @@ namespace AVLTree
         }
     }
 
-    // Public Methods
-    template <typename T>
-    template <typename Iterator>
-    void MultiSet<T>::insert(Iterator begin, Iterator end)
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::refreshPath(Node *node, const T &key)
     {
-        // If bulk is small compared to tree size, do individual insertions
-        size_t bulk_size = std::distance(begin, end);
-        if (bulk_size <= size() / 2)
-        {
-            for (Iterator it = begin; it != end; ++it)
-            {
-                insert(*it);
-            }
+        if (node == nullptr)
             return;
-        }
+        if (key < node->key)
+            refreshPath(node->left, key);
+        else if (key > node->key)
+            refreshPath(node->right, key);
+        Node::refresh(node);
+    }
 
-        // Get current elements in sorted order
-        std::vector<T> current;
-        inorder(root, current);
+    // Decrement in place; a node that reaches zero becomes a tombstone
+    // instead of being unlinked, so nothing is restructured. Its path is
+    // refreshed so has_live stays exact, and the version moves so fingers
+    // positioned on it re-seek.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::removeLazily(Node *node, size_t amount)
+    {
+        size_t removed = std::min(amount, node->count);
+        node->count -= removed;
+        total_count -= removed;
+        if (augmented || node->count == 0)
+            refreshPath(root, node->key);
+        if (node->count > 0)
+            return;
 
-        // Sort the bulk elements
-        std::vector<T> bulk_elements(begin, end);
-        std::sort(bulk_elements.begin(), bulk_elements.end());
+        version++;
+        tombstone_count++;
+        pending_purge.push_back(node->key);
+        if (node == min_node)
+            updateMinNode();
+        if (node == max_node)
+            updateMaxNode();
+        if (pending_purge.size() > compact_threshold * distinct_count)
+            compacting = true;
+    }
 
-        // Merge current and bulk elements
-        std::vector<T> merged;
-        merged.reserve(current.size() + bulk_size);
-        std::merge(current.begin(), current.end(),
-                   bulk_elements.begin(), bulk_elements.end(),
-                   std::back_inserter(merged));
+    // Physically unlink up to compact_batch tombstones. Entries revived
+    // since they were queued are skipped.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::compactStep()
+    {
+        if (!compacting)
+            return;
+        bool purged = false;
+        for (size_t i = 0; i < compact_batch && !pending_purge.empty(); ++i)
+        {
+            T key = pending_purge.back();
+            pending_purge.pop_back();
+            Node *lb = findNode(key);
+            if (lb == nullptr || lb->count > 0)
+                continue;
+            root = remove(root, key, 0);
+            tombstone_count--;
+            purged = true;
+        }
+        if (pending_purge.empty())
+            compacting = false;
+        if (purged)
+        {
+            updateMinNode();
+            updateMaxNode();
+        }
+    }
 
-        // Rebuild tree
-        clear();
-        root = buildFromSorted(merged, 0, merged.size() - 1);
-        updateMinNode();
-        updateMaxNode();
+    // Drop every node without journaling; clear() and the rebuild paths
+    // share it.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::reset()
+    {
+        hash_index.clear();
+        clear(root);
+        root = nullptr;
+        releaseArena();
+        version++;
+        min_node = nullptr;
+        max_node = nullptr;
+        distinct_count = 0;
+        total_count = 0;
+        compacting = false;
+        tombstone_count = 0;
+        pending_purge.clear();
     }
 
-    template <typename T>
-    void MultiSet<T>::insert(const T &key)
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename std::vector<std::pair<T, long long> >::iterator MultiSet<T, Augment, Storage, Balance>::bufferEntry(const T &key) const
     {
-        root = insert(root, key, 1);
+        std::vector<std::pair<T, long long> > &buffer = const_cast<std::vector<std::pair<T, long long> > &>(write_buffer);
+        return std::lower_bound(buffer.begin(), buffer.end(), key,
+                                [](const std::pair<T, long long> &entry, const T &k) { return entry.first < k; });
     }
 
-    template <typename T>
-    void MultiSet<T>::insert_multiple(const T &key, size_t amount)
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::bufferDelta(const T &key, long long delta)
     {
-        root = insert(root, key, amount);
+        typename std::vector<std::pair<T, long long> >::iterator entry = bufferEntry(key);
+        if (entry != write_buffer.end() && entry->first == key)
+            entry->second += delta;
+        else
+            write_buffer.insert(entry, std::make_pair(key, delta));
+        buffered_total += delta;
+        if (write_buffer.size() >= write_buffer_capacity)
+            flush();
     }
 
-    template <typename T>
-    void MultiSet<T>::remove(const T &key)
+    // Reads that need the tree's shape (order statistics, traversal,
+    // fingers) apply pending writes first. Such reads are therefore not
+    // safe to run concurrently while buffering is enabled.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::drainBuffer() const
     {
-        Node *lb = lower_bound(root, key);
-        if (lb == nullptr || lb->key != key)
-            return;
-        root = remove(root, key, 1);
-        updateMinNode();
-        updateMaxNode();
+        if (!write_buffer.empty())
+            const_cast<MultiSet *>(this)->flush();
     }
 
-    template <typename T>
-    void MultiSet<T>::remove_multiple(const T &key, size_t amount)
+    // True when a full bounded set would evict key straight away; keys
+    // equal to the boundary are rejected too, the result is the same.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MultiSet<T, Augment, Storage, Balance>::outOfBound(const T &key) const
     {
-        if (amount <= 0)
+        if (total_count < bound_capacity)
+            return false;
+        if (bound_side == Evict::Max)
+            return !(key < max_node->key);
+        return !(min_node->key < key);
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::insertBounded(const T &key, size_t amount)
+    {
+        drainBuffer();
+        if (outOfBound(key))
+            return;
+        if (Pool::bounded && distinct_count >= node_pool.capacity())
+            makeRoom(key, amount);
+        root = insert(root, key, amount);
+        if (journal)
+            appendJournal(amount == 1 ? JournalOp::Insert : JournalOp::InsertMultiple, key, amount);
+        evictOverflow();
+        compactStep();
+    }
+
+    // A full node pool has no slot for a new key, so evict before the
+    // insert instead of after: purge tombstones, then unlink boundary nodes
+    // that the insert would push out entirely. Only values worse than key
+    // go, so the result matches evicting afterwards.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::makeRoom(const T &key, size_t amount)
+    {
+        if (tombstone_count > 0)
+            compacting = true;
+        while (compacting && distinct_count >= node_pool.capacity())
+            compactStep();
+        while (distinct_count >= node_pool.capacity() && total_count + amount > bound_capacity)
+        {
+            Node *node = bound_side == Evict::Max ? max_node : min_node;
+            if (node == nullptr || (bound_side == Evict::Max ? !(key < node->key) : !(node->key < key)))
+                return;
+            if (total_count + amount - bound_capacity < node->count)
+                return;
+            size_t amount_evicted = node->count;
+            if (journal)
+                appendJournal(amount_evicted == 1 ? JournalOp::Remove : JournalOp::RemoveMultiple, node->key, amount_evicted);
+            T evicted = node->key;
+            root = remove(root, evicted, amount_evicted);
+            updateMinNode();
+            updateMaxNode();
+        }
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::appendJournal(JournalOp op, const T &key, uint64_t amount)
+    {
+        journal_append(journal, op, key, amount);
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::forwardJournal(Journal<T> *journal, JournalOp op, const T &key, uint64_t amount)
+    {
+        journal->append(op, key, amount);
+    }
+
+    // Give up values at the eviction end until the bound holds. A boundary
+    // key with spare duplicates is only decremented in place through the
+    // cached node; nothing is unlinked or rebalanced.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::evictOverflow()
+    {
+        while (total_count > bound_capacity)
+        {
+            Node *node = bound_side == Evict::Max ? max_node : min_node;
+            size_t amount = std::min(total_count - bound_capacity, node->count);
+            if (journal)
+                appendJournal(amount == 1 ? JournalOp::Remove : JournalOp::RemoveMultiple, node->key, amount);
+            if (amount < node->count || lazy_deletion)
+            {
+                removeLazily(node, amount);
+                continue;
+            }
+            T key = node->key;
+            root = remove(root, key, amount);
+            updateMinNode();
+            updateMaxNode();
+        }
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::summary_type MultiSet<T, Augment, Storage, Balance>::summary(Node *node) const
+    {
+        return (node == nullptr) ? Augment::identity() : node->summary;
+    }
+
+    // Summary of all keys >= lo in the subtree; nodes found later lie further left.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::summary_type MultiSet<T, Augment, Storage, Balance>::aggregateFrom(Node *node, const T &lo) const
+    {
+        summary_type result = Augment::identity();
+        while (node)
+        {
+            if (node->key >= lo)
+            {
+                summary_type right = Augment::combine(Augment::from(node->key, node->count), summary(node->right));
+                result = Augment::combine(right, result);
+                node = node->left;
+            }
+            else
+            {
+                node = node->right;
+            }
+        }
+        return result;
+    }
+
+    // Summary of all keys <= hi in the subtree; nodes found later lie further right.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::summary_type MultiSet<T, Augment, Storage, Balance>::aggregateTo(Node *node, const T &hi) const
+    {
+        summary_type result = Augment::identity();
+        while (node)
+        {
+            if (node->key <= hi)
+            {
+                summary_type left = Augment::combine(summary(node->left), Augment::from(node->key, node->count));
+                result = Augment::combine(result, left);
+                node = node->right;
+            }
+            else
+            {
+                node = node->left;
+            }
+        }
+        return result;
+    }
+
+    // Finger
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::Finger::push(Node *node, bool left_child)
+    {
+        int parent = static_cast<int>(path.size()) - 1;
+        Frame frame = {node, -1, -1};
+        if (parent >= 0)
+        {
+            frame.lo = left_child ? path[parent].lo : parent;
+            frame.hi = left_child ? parent : path[parent].hi;
+        }
+        path.push_back(frame);
+    }
+
+    // Climb to the lowest frame whose bounds strictly contain target, then
+    // descend to target or to the leaf it would hang from. Returns the
+    // depth of the first key >= target, or -1 if there is none.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    int MultiSet<T, Augment, Storage, Balance>::Finger::descend(const T &target)
+    {
+        if (version != tree->version)
+        {
+            path.clear();
+            version = tree->version;
+        }
+        if (path.empty())
+        {
+            if (tree->root == nullptr)
+                return -1;
+            push(tree->root, false);
+        }
+
+        while (path.size() > 1)
+        {
+            const Frame &frame = path.back();
+            if ((frame.lo < 0 || path[frame.lo].node->key < target) &&
+                (frame.hi < 0 || target < path[frame.hi].node->key))
+                break;
+            path.pop_back();
+        }
+
+        int candidate = path.back().hi;
+        while (true)
+        {
+            Node *node = path.back().node;
+            if (target < node->key)
+            {
+                candidate = static_cast<int>(path.size()) - 1;
+                if (node->left == nullptr)
+                    break;
+                push(node->left, true);
+            }
+            else if (target > node->key)
+            {
+                if (node->right == nullptr)
+                    break;
+                push(node->right, false);
+            }
+            else
+            {
+                candidate = static_cast<int>(path.size()) - 1;
+                break;
+            }
+        }
+        return candidate;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::Finger::step(bool forward)
+    {
+        Frame frame = path.back();
+        Node *child = forward ? frame.node->right : frame.node->left;
+        if (child)
+        {
+            push(child, !forward);
+            while ((child = forward ? path.back().node->left : path.back().node->right) != nullptr)
+                push(child, forward);
+            return;
+        }
+        int ancestor = forward ? frame.hi : frame.lo;
+        if (ancestor < 0)
+            path.clear();
+        else
+            path.resize(ancestor + 1);
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::Finger::skipTombstones(bool forward)
+    {
+        while (!path.empty() && path.back().node->count == 0)
+            step(forward);
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MultiSet<T, Augment, Storage, Balance>::Finger::seek(const T &target)
+    {
+        if (tree == nullptr)
+            return false;
+        int candidate = descend(target);
+        if (candidate < 0)
+        {
+            path.clear();
+            return false;
+        }
+        path.resize(candidate + 1);
+        skipTombstones(true);
+        return !path.empty() && path.back().node->key == target;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MultiSet<T, Augment, Storage, Balance>::Finger::next()
+    {
+        if (!valid())
+        {
+            path.clear();
+            return false;
+        }
+        step(true);
+        skipTombstones(true);
+        return !path.empty();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MultiSet<T, Augment, Storage, Balance>::Finger::prev()
+    {
+        if (!valid())
+        {
+            path.clear();
+            return false;
+        }
+        step(false);
+        skipTombstones(false);
+        return !path.empty();
+    }
+
+    // Public Methods
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    template <typename Iterator>
+    void MultiSet<T, Augment, Storage, Balance>::insert(Iterator begin, Iterator end)
+    {
+        if (trace && trace_depth == 0)
+            trace->record_bulk(begin, end);
+        TraceScope scope(this);
+
+        // Bounded: keep only the batch values that beat the boundary, and
+        // of those no more than the bound, before touching the tree.
+        if (bound_capacity)
+        {
+            drainBuffer();
+            std::vector<T> kept;
+            if (total_count < bound_capacity)
+                kept.assign(begin, end);
+            else if (bound_side == Evict::Max)
+                std::copy_if(begin, end, std::back_inserter(kept), [this](const T &key) { return key < max_node->key; });
+            else
+                std::copy_if(begin, end, std::back_inserter(kept), [this](const T &key) { return min_node->key < key; });
+            if (kept.size() > bound_capacity)
+            {
+                if (bound_side == Evict::Max)
+                    std::nth_element(kept.begin(), kept.begin() + bound_capacity, kept.end());
+                else
+                    std::nth_element(kept.begin(), kept.begin() + bound_capacity, kept.end(), std::greater<T>());
+                kept.resize(bound_capacity);
+            }
+            size_t saved_capacity = bound_capacity;
+            bound_capacity = 0;
+            try
+            {
+                insert(kept.begin(), kept.end());
+            }
+            catch (...)
+            {
+                bound_capacity = saved_capacity;
+                throw;
+            }
+            bound_capacity = saved_capacity;
+            drainBuffer();
+            evictOverflow();
+            return;
+        }
+        // If bulk is small compared to tree size, do individual insertions
+        size_t bulk_size = std::distance(begin, end);
+        if (bulk_size <= size() / 2)
+        {
+            for (Iterator it = begin; it != end; ++it)
+            {
+                insert(*it);
+            }
+            return;
+        }
+
+        // Get current elements in sorted order
+        drainBuffer();
+        std::vector<T> current;
+        inorder(root, current);
+
+        // Sort the bulk elements
+        std::vector<T> bulk_elements(begin, end);
+        std::sort(bulk_elements.begin(), bulk_elements.end());
+
+        // Merge current and bulk elements
+        std::vector<T> merged;
+        merged.reserve(current.size() + bulk_size);
+        std::merge(current.begin(), current.end(),
+                   bulk_elements.begin(), bulk_elements.end(),
+                   std::back_inserter(merged));
+
+        // Start of each run of equal keys, plus the end
+        std::vector<size_t> runs;
+        for (size_t i = 0; i < merged.size(); ++i)
+        {
+            if (i == 0 || merged[i - 1] < merged[i])
+                runs.push_back(i);
+        }
+        runs.push_back(merged.size());
+
+        size_t peak = (current.capacity() + bulk_elements.capacity() + merged.capacity()) * sizeof(T) +
+                      runs.capacity() * sizeof(size_t);
+        bulk_peak_bytes = std::max(bulk_peak_bytes, peak);
+
+        // A bounded pool must fail before the old tree is torn down
+        if (Pool::bounded && runs.size() - 1 > node_pool.capacity())
+            throw std::length_error("Node capacity exceeded");
+
+        // Rebuild tree
+        reset();
+        if (hash_indexed)
+            hash_index.reserve(runs.size() - 1);
+        root = buildFromSorted(merged, runs, 0, runs.size() - 1);
+        updateMinNode();
+        updateMaxNode();
+        if (journal)
+        {
+            for (size_t i = 0; i < bulk_elements.size(); ++i)
+                appendJournal(JournalOp::Insert, bulk_elements[i]);
+        }
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::insert(const T &key)
+    {
+        TraceScope scope(this, TraceOp::Insert, key);
+        if (bound_capacity)
+        {
+            insertBounded(key, 1);
+            return;
+        }
+        if (write_buffer_capacity)
+        {
+            if (journal)
+                appendJournal(JournalOp::Insert, key);
+            bufferDelta(key, 1);
+            return;
+        }
+        if (!addToExisting(key, 1))
+            root = insert(root, key, 1);
+        if (journal)
+            appendJournal(JournalOp::Insert, key);
+        compactStep();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::insert_multiple(const T &key, size_t amount)
+    {
+        TraceScope scope(this, TraceOp::InsertMultiple, key, amount);
+        if (bound_capacity)
+        {
+            insertBounded(key, amount);
+            return;
+        }
+        if (write_buffer_capacity)
+        {
+            if (journal)
+                appendJournal(JournalOp::InsertMultiple, key, amount);
+            bufferDelta(key, static_cast<long long>(amount));
+            return;
+        }
+        if (!addToExisting(key, amount))
+            root = insert(root, key, amount);
+        if (journal)
+            appendJournal(JournalOp::InsertMultiple, key, amount);
+        compactStep();
+    }
+
+    // Insert next to the finger's position. Only the path below the lowest
+    // common subtree is walked, and the height fix-up stops as soon as a
+    // subtree's height is unchanged (unless summaries, or has_live over a
+    // run of tombstones, must reach further up).
+    // The finger is left on key.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::insert(Finger &hint, const T &key)
+    {
+        TraceScope scope(this, TraceOp::Insert, key);
+        drainBuffer();
+        if (hint.tree != this)
+            hint = finger();
+        if (root == nullptr || bound_capacity)
+        {
+            insert(key);
+            hint.seek(key);
             return;
-        Node *lb = lower_bound(root, key);
-        if (lb == nullptr || lb->key != key)
+        }
+
+        typedef typename Finger::Frame Frame;
+        std::vector<Frame> &path = hint.path;
+        hint.descend(key);
+        Node *last = path.back().node;
+
+        if (last->key == key)
+        {
+            bool revived = last->count == 0;
+            if (revived)
+            {
+                // Reviving a tombstone
+                tombstone_count--;
+                if (min_node == nullptr || key < min_node->key)
+                    min_node = last;
+                if (max_node == nullptr || key > max_node->key)
+                    max_node = last;
+            }
+            last->count++;
+            total_count++;
+            if (augmented || revived)
+            {
+                for (size_t i = path.size(); i-- > 0;)
+                    Node::refresh(path[i].node);
+            }
+            if (journal)
+                appendJournal(JournalOp::Insert, key);
+            compactStep();
             return;
+        }
+
+        Node *newNode = createNode(key, 1);
+        Node::refresh(newNode);
+        distinct_count++;
+        total_count++;
+        version++;
+        hint.version = version;
+        bool left_child = key < last->key;
+        if (left_child)
+            last->left = newNode;
+        else
+            last->right = newNode;
+        hint.push(newNode, left_child);
+        if (min_node == nullptr || key < min_node->key)
+            min_node = newNode;
+        if (max_node == nullptr || key > max_node->key)
+            max_node = newNode;
+
+        int rotated = -1;
+        bool settled = false;
+        for (int i = static_cast<int>(path.size()) - 2; i >= 0; --i)
+        {
+            Node *node = path[i].node;
+            if (settled)
+            {
+                // Ancestors of a live node already have has_live set
+                if (!augmented && node->has_live)
+                    break;
+                Node::refresh(node);
+                continue;
+            }
+            short before = node->height;
+            Node *subtree = Balance::rebalance(node);
+            if (subtree != node)
+            {
+                rotated = i;
+                path[i].node = subtree;
+                if (i == 0)
+                    root = subtree;
+                else if (path[i - 1].node->left == node)
+                    path[i - 1].node->left = subtree;
+                else
+                    path[i - 1].node->right = subtree;
+            }
+            if (subtree->height == before)
+                settled = true;
+        }
+
+        // A rotation reshaped the subtree under path[rotated]; its bounds
+        // still hold, so re-descend from there.
+        if (rotated >= 0)
+        {
+            path.resize(rotated + 1);
+            hint.descend(key);
+        }
+        if (journal)
+            appendJournal(JournalOp::Insert, key);
+        compactStep();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Finger MultiSet<T, Augment, Storage, Balance>::finger() const
+    {
+        drainBuffer();
+        return Finger(this);
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::Finger MultiSet<T, Augment, Storage, Balance>::finger(const T &key) const
+    {
+        drainBuffer();
+        Finger f(this);
+        f.seek(key);
+        return f;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::remove(const T &key)
+    {
+        TraceScope scope(this, TraceOp::Remove, key);
+        if (write_buffer_capacity)
+        {
+            remove_multiple(key, 1);
+            return;
+        }
+        Node *lb = findNode(key);
+        if (lb == nullptr || lb->count == 0)
+            return;
+        if (journal)
+            appendJournal(JournalOp::Remove, key);
+        if (lazy_deletion)
+        {
+            removeLazily(lb, 1);
+            compactStep();
+            return;
+        }
+        root = remove(root, key, 1);
+        updateMinNode();
+        updateMaxNode();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::remove_multiple(const T &key, size_t amount)
+    {
+        TraceScope scope(this, TraceOp::RemoveMultiple, key, amount);
+        if (amount <= 0)
+            return;
+        if (write_buffer_capacity)
+        {
+            amount = std::min(amount, count(key));
+            if (amount == 0)
+                return;
+            if (journal)
+                appendJournal(amount == 1 ? JournalOp::Remove : JournalOp::RemoveMultiple, key, amount);
+            bufferDelta(key, -static_cast<long long>(amount));
+            return;
+        }
+        Node *lb = findNode(key);
+        if (lb == nullptr || lb->count == 0)
+            return;
+        if (journal)
+            appendJournal(JournalOp::RemoveMultiple, key, amount);
+        if (lazy_deletion)
+        {
+            removeLazily(lb, amount);
+            compactStep();
+            return;
+        }
         root = remove(root, key, amount);
         updateMinNode();
         updateMaxNode();
     }
 
-    template <typename T>
-    void MultiSet<T>::remove_all(const T &key)
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::remove_all(const T &key)
     {
-        Node *lb = lower_bound(root, key);
-        if (lb == nullptr || lb->key != key)
+        TraceScope scope(this, TraceOp::RemoveAll, key);
+        if (write_buffer_capacity)
+        {
+            size_t amount = count(key);
+            if (amount == 0)
+                return;
+            if (journal)
+                appendJournal(JournalOp::RemoveAll, key);
+            bufferDelta(key, -static_cast<long long>(amount));
+            return;
+        }
+        Node *lb = findNode(key);
+        if (lb == nullptr || lb->count == 0)
+            return;
+        if (journal)
+            appendJournal(JournalOp::RemoveAll, key);
+        if (lazy_deletion)
+        {
+            removeLazily(lb, lb->count);
+            compactStep();
             return;
+        }
         root = remove(root, key, lb->count);
         updateMinNode();
         updateMaxNode();
     }
 
-    template <typename T>
-    size_t MultiSet<T>::count(const T &key) const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MultiSet<T, Augment, Storage, Balance>::count(const T &key) const
     {
-        Node *node = lower_bound(root, key);
-        if (node && node->key == key)
+        TraceScope scope(this, TraceOp::Count, key);
+        size_t result = 0;
+        Node *node = findNode(key);
+        if (node)
         {
-            return node->count;
+            result = node->count;
         }
-        return 0;
+        if (!write_buffer.empty())
+        {
+            typename std::vector<std::pair<T, long long> >::iterator entry = bufferEntry(key);
+            if (entry != write_buffer.end() && entry->first == key)
+                result = static_cast<size_t>(static_cast<long long>(result) + entry->second);
+        }
+        return result;
     }
 
-    template <typename T>
-    bool MultiSet<T>::contains(const T &key) const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MultiSet<T, Augment, Storage, Balance>::contains(const T &key) const
     {
-        Node *node = lower_bound(root, key);
-        return node != nullptr && node->key == key;
+        TraceScope scope(this, TraceOp::Contains, key);
+        if (!write_buffer.empty())
+            return count(key) > 0;
+        Node *node = findNode(key);
+        return node != nullptr && node->count > 0;
     }
 
-    template <typename T>
-    T MultiSet<T>::min() const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    T MultiSet<T, Augment, Storage, Balance>::min() const
     {
+        TraceScope scope(this, TraceOp::Min);
+        drainBuffer();
         if (!min_node)
             throw std::runtime_error("Tree is empty");
         return min_node->key;
     }
 
-    template <typename T>
-    T MultiSet<T>::max() const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    T MultiSet<T, Augment, Storage, Balance>::max() const
     {
+        TraceScope scope(this, TraceOp::Max);
+        drainBuffer();
         if (!max_node)
             throw std::runtime_error("Tree is empty");
         return max_node->key;
     }
 
-    template <typename T>
-    T MultiSet<T>::pop_min()
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    T MultiSet<T, Augment, Storage, Balance>::pop_min()
     {
+        TraceScope scope(this, TraceOp::PopMin);
+        drainBuffer();
         if (!min_node)
             throw std::runtime_error("Tree is empty");
         T minimum = min_node->key;
@@ -553,9 +1730,11 @@ namespace AVLTree
         return minimum;
     }
 
-    template <typename T>
-    T MultiSet<T>::pop_max()
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    T MultiSet<T, Augment, Storage, Balance>::pop_max()
     {
+        TraceScope scope(this, TraceOp::PopMax);
+        drainBuffer();
         if (!max_node)
             throw std::runtime_error("Tree is empty");
         T maximum = max_node->key;
@@ -563,43 +1742,305 @@ namespace AVLTree
         return maximum;
     }
 
-    template <typename T>
-    size_t MultiSet<T>::size() const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MultiSet<T, Augment, Storage, Balance>::size() const
     {
-        return total_count;
+        return total_count + buffered_total;
     }
 
-    template <typename T>
-    bool MultiSet<T>::empty() const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    bool MultiSet<T, Augment, Storage, Balance>::empty() const
     {
-        return total_count == 0;
+        return size() == 0;
     }
 
-    template <typename T>
-    size_t MultiSet<T>::distinct_size() const
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MultiSet<T, Augment, Storage, Balance>::distinct_size() const
     {
-        return distinct_count;
+        drainBuffer();
+        return distinct_count - tombstone_count;
     }
 
-    template <typename T>
-    void MultiSet<T>::clear()
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MultiSet<T, Augment, Storage, Balance>::tombstone_size() const
     {
-        clear(root);
-        root = nullptr;
-        min_node = nullptr;
-        max_node = nullptr;
-        distinct_count = 0;
-        total_count = 0;
+        drainBuffer();
+        return tombstone_count;
     }
 
-    template <typename T>
-    std::vector<T> MultiSet<T>::to_vector() const
+    // With lazy deletion, removals only decrement counts; once tombstones
+    // exceed `threshold` of the nodes they are purged compact_batch per
+    // mutating call. Disabling it purges every tombstone immediately.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::set_lazy_deletion(bool enabled, double threshold)
+    {
+        lazy_deletion = enabled;
+        compact_threshold = threshold;
+        if (!enabled)
+        {
+            compacting = true;
+            while (compacting)
+                compactStep();
+        }
+    }
+
+    // Buffer up to `capacity` distinct keys of point updates (0 disables
+    // and applies anything pending). count(), contains() and size() see
+    // buffered updates without applying them. The log is a sorted vector,
+    // so a few hundred entries is the sweet spot; buffered removals still
+    // look up the tree to clamp their amount.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::set_write_buffer(size_t capacity)
+    {
+        write_buffer_capacity = capacity;
+        flush();
+    }
+
+    // Apply the buffered deltas in key order: removals first, then the
+    // insertions as one sorted run, through the bulk rebuild when the run
+    // is large next to the tree and otherwise through a hinted finger, so
+    // consecutive keys only walk the part of the tree between them.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::flush()
     {
+        if (write_buffer.empty())
+            return;
+        TraceScope scope(this);
+        std::vector<std::pair<T, long long> > pending;
+        pending.swap(write_buffer);
+        buffered_total = 0;
+
+        // Already journaled when buffered
+        Journal<T> *saved_journal = journal;
+        size_t saved_capacity = write_buffer_capacity;
+        journal = nullptr;
+        write_buffer_capacity = 0;
+        try
+        {
+            size_t inserted = 0;
+            for (size_t i = 0; i < pending.size(); ++i)
+            {
+                if (pending[i].second < 0)
+                    remove_multiple(pending[i].first, static_cast<size_t>(-pending[i].second));
+                else
+                    inserted += static_cast<size_t>(pending[i].second);
+            }
+            if (inserted > size() / 2)
+            {
+                std::vector<T> keys;
+                keys.reserve(inserted);
+                for (size_t i = 0; i < pending.size(); ++i)
+                {
+                    if (pending[i].second > 0)
+                        keys.insert(keys.end(), static_cast<size_t>(pending[i].second), pending[i].first);
+                }
+                insert(keys.begin(), keys.end());
+            }
+            else if (inserted > 0)
+            {
+                Finger hint = finger();
+                for (size_t i = 0; i < pending.size(); ++i)
+                {
+                    for (long long k = 0; k < pending[i].second; ++k)
+                        insert(hint, pending[i].first);
+                }
+            }
+        }
+        catch (...)
+        {
+            journal = saved_journal;
+            write_buffer_capacity = saved_capacity;
+            throw;
+        }
+        journal = saved_journal;
+        write_buffer_capacity = saved_capacity;
+        if (pending.capacity() > write_buffer.capacity())
+            pending.swap(write_buffer);
+        write_buffer.clear();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    MemoryUsage MultiSet<T, Augment, Storage, Balance>::memory_usage() const
+    {
+        drainBuffer();
+        MemoryUsage usage;
+        size_t heap_nodes = distinct_count - arena_used;
+        usage.node_bytes = distinct_count * sizeof(Node);
+        if (Pool::bounded)
+            usage.allocator_slack = (node_pool.capacity() - distinct_count) * sizeof(Node);
+        else
+            usage.allocator_slack = heap_nodes * (detail::mallocChunkSize(sizeof(Node)) - sizeof(Node)) +
+                                    (arena_capacity - arena_used) * sizeof(Node);
+        usage.bookkeeping_bytes = pending_purge.capacity() * sizeof(T) + arena_free.capacity() * sizeof(Node *) +
+                                  hash_index.memory_bytes();
+        usage.bulk_peak_bytes = bulk_peak_bytes;
+        return usage;
+    }
+
+    // Move every live node into one freshly allocated block, laid out in key
+    // order or van Emde Boas order, as a perfectly balanced tree. Tombstones
+    // are dropped. Restores locality after heavy churn.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::compact(NodeLayout layout)
+    {
+        drainBuffer();
+        std::vector<Node *> nodes;
+        nodes.reserve(distinct_count - tombstone_count);
+        collectLive(root, nodes);
+        size_t n = nodes.size();
+
+        // slot[i] is where the i-th smallest key goes
+        std::vector<size_t> slot(n);
+        if (layout == NodeLayout::VanEmdeBoas)
+        {
+            int levels = 0;
+            while ((static_cast<size_t>(1) << levels) <= n)
+                levels++;
+            std::vector<size_t> order;
+            order.reserve(n);
+            vebOrder(0, n, levels, order);
+            for (size_t i = 0; i < n; ++i)
+                slot[order[i]] = i;
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i)
+                slot[i] = i;
+        }
+
+        size_t peak = nodes.capacity() * sizeof(Node *) + 2 * slot.capacity() * sizeof(size_t) + n * sizeof(Node);
+        bulk_peak_bytes = std::max(bulk_peak_bytes, peak);
+
+        // A bounded pool cannot hold a second copy of the tree, so the live
+        // nodes are copied out and the pool is rebuilt from its first slot.
+        // The pool then keeps recycling those slots itself; no arena.
+        std::vector<Node> copies;
+        if (Pool::bounded)
+        {
+            copies.reserve(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                copies.push_back(*nodes[i]);
+                nodes[i] = &copies[i];
+            }
+            reset();
+        }
+        Node *storage = n ? static_cast<Node *>(node_pool.allocate_block(n)) : nullptr;
+        Node *new_root = buildCompact(nodes, 0, n, slot, storage);
+
+        if (!Pool::bounded)
+        {
+            reset();
+            arena = storage;
+            arena_capacity = n;
+            arena_used = n;
+        }
+        root = new_root;
+        distinct_count = n;
+        for (size_t i = 0; i < n; ++i)
+            total_count += storage[i].count;
+        updateMinNode();
+        updateMaxNode();
+        rebuildIndex();
+    }
+
+    // Keep at most `capacity` values (0 removes the bound), evicting from
+    // the `side` end: Evict::Max keeps the smallest values, Evict::Min the
+    // largest. A full set rejects keys on the wrong side of the boundary
+    // in O(1); inserts bypass the write buffer. Values beyond the new
+    // bound are evicted immediately.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::set_bound(size_t capacity, Evict side)
+    {
+        drainBuffer();
+        bound_capacity = capacity;
+        bound_side = side;
+        if (capacity)
+            evictOverflow();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    size_t MultiSet<T, Augment, Storage, Balance>::bound() const
+    {
+        return bound_capacity;
+    }
+
+    // Keep a Swiss-table index from key to node next to the tree, so
+    // count(), contains() and the lookups in removals are O(1) expected
+    // instead of O(log n) pointer chasing, and re-inserting a present key
+    // skips the descent (unaugmented sets only). Ordered queries still use
+    // the tree. Costs about sizeof(T) + sizeof(Node *) + 1 bytes per
+    // distinct key, divided by the table's load (7/16 to 7/8).
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::set_hash_index(bool enabled)
+    {
+        drainBuffer();
+        hash_indexed = enabled;
+        rebuildIndex();
+    }
+
+    // Record mutations in `journal` (nullptr detaches). The journal must
+    // outlive the set or be detached first.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::attach_journal(Journal<T> *journal)
+    {
+        this->journal = journal;
+        journal_append = &forwardJournal;
+    }
+
+    // Record public calls in `trace` (nullptr detaches): inserts, removals,
+    // count/contains, min/max, pops and clear. Other reads and tuning calls
+    // are not recorded. The recorder must outlive the set or be detached.
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::attach_trace(TraceRecorder<T> *trace)
+    {
+        this->trace = trace;
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    void MultiSet<T, Augment, Storage, Balance>::clear()
+    {
+        TraceScope scope(this, TraceOp::Clear);
+        if (journal && (root || !write_buffer.empty()))
+            appendJournal(JournalOp::Clear, T());
+        write_buffer.clear();
+        buffered_total = 0;
+        reset();
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    std::vector<T> MultiSet<T, Augment, Storage, Balance>::to_vector() const
+    {
+        drainBuffer();
         std::vector<T> result;
         inorder(root, result);
         return result;
     }
 
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::summary_type MultiSet<T, Augment, Storage, Balance>::aggregate(const T &lo, const T &hi) const
+    {
+        drainBuffer();
+        // Descend to the highest node inside [lo, hi]; the range then splits
+        // into a suffix of its left subtree and a prefix of its right subtree.
+        Node *node = root;
+        while (node && (node->key < lo || node->key > hi))
+            node = (node->key < lo) ? node->right : node->left;
+        if (node == nullptr)
+            return Augment::identity();
+
+        summary_type result = aggregateFrom(node->left, lo);
+        result = Augment::combine(result, Augment::from(node->key, node->count));
+        return Augment::combine(result, aggregateTo(node->right, hi));
+    }
+
+    template <typename T, typename Augment, typename Storage, typename Balance>
+    typename MultiSet<T, Augment, Storage, Balance>::summary_type MultiSet<T, Augment, Storage, Balance>::aggregate() const
+    {
+        drainBuffer();
+        return summary(root);
+    }
+
 } // namespace AVLTree
 
 #endif // MULTISET_HPP
\ No newline at end of file
@@ -18,8 +18,8 @@ namespace AVLTree {
             short height;
             Node *left;
             Node *right;
-            Node(const T &k, size_t cnt = 1)
-                : key(k), height(1), count(cnt), left(nullptr), right(nullptr) {}
+            Node(const T &k)
+                : key(k), height(1), left(nullptr), right(nullptr) {}
         };
 
         Node *root;
@@ -0,0 +1,544 @@
+#ifndef SHARDED_MULTISET_HPP
+#define SHARDED_MULTISET_HPP
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <type_traits>
+#include <limits>
+#include "multiset.hpp"
+
+namespace AVLTree
+{
+
+    // A MultiSet split into key-range shards, each with its own lock, so
+    // writers touching different ranges never contend.
+    //
+    // Routing reads an immutable Layout (boundaries plus shard pointers)
+    // without locking. Re-splitting or merging shards publishes a new
+    // Layout and retires the shards it replaced; a writer that locks a
+    // retired shard simply routes again. A shard is emptied as it retires,
+    // since no writer reaches its set afterwards; the empty shells and the
+    // replaced layouts are kept until destruction, a few hundred bytes per
+    // rebalance. A shard that cannot be split (one distinct key) or
+    // merged (its neighbours are too big) is left alone until its size
+    // has doubled or halved again, so hot single keys do not retry on
+    // every write.
+    template <typename T>
+    class ShardedMultiSet
+    {
+    private:
+        struct Shard
+        {
+            MultiSet<T> set;
+            std::mutex mutex;
+            bool retired;
+            std::atomic<size_t> split_floor;   // don't try splitting below this size
+            std::atomic<size_t> merge_ceiling; // don't try merging above this size
+            Shard() : retired(false), split_floor(0), merge_ceiling(std::numeric_limits<size_t>::max()) {}
+        };
+
+        // shards[i] holds keys in [bounds[i - 1], bounds[i])
+        struct Layout
+        {
+            std::vector<T> bounds;
+            std::vector<Shard *> shards;
+
+            size_t index(const T &key) const
+            {
+                return std::upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin();
+            }
+        };
+
+        static const size_t sample_per_shard = 256;
+        static const size_t parallel_batch = 4096;
+
+        std::atomic<const Layout *> layout;
+        std::atomic<size_t> target_size; // per-shard size rebalancing aims for
+        size_t shard_target;
+        size_t min_shard_size;
+        std::mutex rebalance_mutex;
+        std::vector<std::unique_ptr<Layout> > layouts;
+        std::vector<std::unique_ptr<Shard> > shards;
+
+        Shard *newShard();
+        void publish(Layout *next);
+        Shard *acquire(const T &key) const;
+        const Layout *acquireAll() const;
+        void releaseAll(const Layout *l) const;
+        void maybeRebalance(Shard *shard, size_t shard_size);
+        void rebalance(Shard *shard);
+        void seed(const std::vector<T> &batch);
+
+    public:
+        explicit ShardedMultiSet(size_t shard_count = 8, size_t min_shard_size = 4096);
+        // Integral arguments must pick the constructor above
+        template <typename Iterator, typename = typename std::enable_if<!std::is_integral<Iterator>::value>::type>
+        ShardedMultiSet(Iterator begin, Iterator end, size_t shard_count = 8, size_t min_shard_size = 4096);
+        template <typename Iterator>
+        void insert(Iterator begin, Iterator end);
+        void insert(const T &key);
+        void insert_multiple(const T &key, size_t amount);
+        void remove(const T &key);
+        void remove_multiple(const T &key, size_t amount);
+        void remove_all(const T &key);
+        size_t count(const T &key) const;
+        bool contains(const T &key) const;
+        T min() const;
+        T max() const;
+        size_t size() const;
+        bool empty() const;
+        size_t shard_count() const;
+        void clear();
+        std::vector<T> to_vector() const;
+        template <typename Visitor>
+        void for_each(Visitor visit) const;
+    };
+
+    // Constructor
+    template <typename T>
+    ShardedMultiSet<T>::ShardedMultiSet(size_t shard_count, size_t min_shard_size)
+        : target_size(std::max<size_t>(min_shard_size, 1)), shard_target(std::max<size_t>(shard_count, 1)),
+          min_shard_size(std::max<size_t>(min_shard_size, 1))
+    {
+        Layout *initial = new Layout();
+        initial->shards.push_back(newShard());
+        layouts.push_back(std::unique_ptr<Layout>(initial));
+        layout.store(initial);
+    }
+
+    template <typename T>
+    template <typename Iterator, typename>
+    ShardedMultiSet<T>::ShardedMultiSet(Iterator begin, Iterator end, size_t shard_count, size_t min_shard_size)
+        : ShardedMultiSet(shard_count, min_shard_size)
+    {
+        insert(begin, end);
+    }
+
+    // Private Helper Methods
+    template <typename T>
+    typename ShardedMultiSet<T>::Shard *ShardedMultiSet<T>::newShard()
+    {
+        shards.push_back(std::unique_ptr<Shard>(new Shard()));
+        return shards.back().get();
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::publish(Layout *next)
+    {
+        layouts.push_back(std::unique_ptr<Layout>(next));
+        layout.store(next, std::memory_order_release);
+    }
+
+    // Lock the shard that owns key under the current layout.
+    template <typename T>
+    typename ShardedMultiSet<T>::Shard *ShardedMultiSet<T>::acquire(const T &key) const
+    {
+        while (true)
+        {
+            const Layout *l = layout.load(std::memory_order_acquire);
+            Shard *shard = l->shards[l->index(key)];
+            shard->mutex.lock();
+            if (!shard->retired)
+                return shard;
+            shard->mutex.unlock();
+        }
+    }
+
+    // Lock every shard, in key order, of a layout that is still current.
+    template <typename T>
+    const typename ShardedMultiSet<T>::Layout *ShardedMultiSet<T>::acquireAll() const
+    {
+        while (true)
+        {
+            const Layout *l = layout.load(std::memory_order_acquire);
+            size_t locked = 0;
+            bool stale = false;
+            for (; locked < l->shards.size(); ++locked)
+            {
+                l->shards[locked]->mutex.lock();
+                if (l->shards[locked]->retired)
+                {
+                    stale = true;
+                    locked++;
+                    break;
+                }
+            }
+            if (!stale)
+                return l;
+            for (size_t i = 0; i < locked; ++i)
+                l->shards[i]->mutex.unlock();
+        }
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::releaseAll(const Layout *l) const
+    {
+        for (size_t i = 0; i < l->shards.size(); ++i)
+            l->shards[i]->mutex.unlock();
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::maybeRebalance(Shard *shard, size_t shard_size)
+    {
+        const Layout *l = layout.load(std::memory_order_acquire);
+        size_t target = target_size.load(std::memory_order_relaxed);
+        bool too_big = shard_size > 2 * target && shard_size >= shard->split_floor.load(std::memory_order_relaxed);
+        bool too_small = l->shards.size() > 1 && shard_size < target / 4 &&
+                         shard_size <= shard->merge_ceiling.load(std::memory_order_relaxed);
+        if (too_big || too_small)
+            rebalance(shard);
+    }
+
+    // Split an oversized shard at its median, or fold an undersized one into
+    // its smaller neighbour. Only the shards involved are locked; writers on
+    // the others carry on. Concurrent callers skip rather than queue. A new
+    // layout is published only when shards actually change.
+    template <typename T>
+    void ShardedMultiSet<T>::rebalance(Shard *shard)
+    {
+        std::unique_lock<std::mutex> guard(rebalance_mutex, std::try_to_lock);
+        if (!guard.owns_lock())
+            return;
+
+        const Layout *current = layout.load(std::memory_order_acquire);
+        size_t i = std::find(current->shards.begin(), current->shards.end(), shard) - current->shards.begin();
+        if (i == current->shards.size())
+            return;
+
+        // Refresh the per-shard target from the current total
+        size_t total = 0;
+        std::vector<size_t> sizes(current->shards.size());
+        for (size_t j = 0; j < current->shards.size(); ++j)
+        {
+            std::lock_guard<std::mutex> lock(current->shards[j]->mutex);
+            sizes[j] = current->shards[j]->set.size();
+            total += sizes[j];
+        }
+
+        size_t target = std::max(total / shard_target, min_shard_size);
+        target_size.store(target, std::memory_order_relaxed);
+
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        size_t shard_size = shard->set.size();
+        if (shard_size > 2 * target)
+        {
+            // Splitting needs two distinct keys; checking first avoids
+            // copying a shard that holds a single hot key
+            if (shard->set.distinct_size() < 2)
+            {
+                shard->split_floor.store(2 * shard_size, std::memory_order_relaxed);
+                return;
+            }
+            std::vector<T> keys = shard->set.to_vector();
+            typename std::vector<T>::iterator split = std::lower_bound(keys.begin(), keys.end(), keys[keys.size() / 2]);
+            if (split == keys.begin())
+                split = std::upper_bound(keys.begin(), keys.end(), keys.front());
+            Shard *lower = newShard();
+            Shard *upper = newShard();
+            lower->set.insert(keys.begin(), split);
+            upper->set.insert(split, keys.end());
+            Layout *next = new Layout(*current);
+            next->shards[i] = lower;
+            next->shards.insert(next->shards.begin() + i + 1, upper);
+            next->bounds.insert(next->bounds.begin() + i, *split);
+            publish(next);
+            shard->retired = true;
+            shard->set.clear();
+        }
+        else if (current->shards.size() > 1 && shard_size < target / 4)
+        {
+            // Merge with the smaller neighbour unless the result would
+            // need splitting straight away
+            size_t left = i;
+            if (i + 1 == current->shards.size() || (i > 0 && sizes[i - 1] < sizes[i + 1]))
+                left = i - 1;
+            size_t neighbour = (left == i) ? sizes[i + 1] : sizes[i - 1];
+            if (shard_size + neighbour > 2 * target)
+            {
+                shard->merge_ceiling.store(shard_size / 2, std::memory_order_relaxed);
+                return;
+            }
+            lock.unlock();
+            // Lock both in key order
+            Shard *a = current->shards[left];
+            Shard *b = current->shards[left + 1];
+            std::lock_guard<std::mutex> lock_a(a->mutex);
+            std::lock_guard<std::mutex> lock_b(b->mutex);
+
+            std::vector<T> keys = a->set.to_vector();
+            std::vector<T> upper = b->set.to_vector();
+            keys.insert(keys.end(), upper.begin(), upper.end());
+            Shard *merged = newShard();
+            merged->set.insert(keys.begin(), keys.end());
+            Layout *next = new Layout(*current);
+            next->shards[left] = merged;
+            next->shards.erase(next->shards.begin() + left + 1);
+            next->bounds.erase(next->bounds.begin() + left);
+            publish(next);
+            a->retired = true;
+            b->retired = true;
+            a->set.clear();
+            b->set.clear();
+        }
+    }
+
+    // First bulk load into an empty set: cut the key space at quantiles of
+    // a sample of the batch so every shard starts out the same size.
+    template <typename T>
+    void ShardedMultiSet<T>::seed(const std::vector<T> &batch)
+    {
+        std::lock_guard<std::mutex> guard(rebalance_mutex);
+        const Layout *current = layout.load(std::memory_order_acquire);
+        if (current->shards.size() != 1)
+            return;
+        Shard *only = current->shards[0];
+        std::lock_guard<std::mutex> lock(only->mutex);
+        if (!only->set.empty())
+            return;
+
+        size_t sample_size = std::min(batch.size(), shard_target * sample_per_shard);
+        std::vector<T> sample;
+        sample.reserve(sample_size);
+        for (size_t k = 0; k < sample_size; ++k)
+            sample.push_back(batch[k * batch.size() / sample_size]);
+        std::sort(sample.begin(), sample.end());
+
+        target_size.store(std::max(batch.size() / shard_target, min_shard_size), std::memory_order_relaxed);
+        Layout *next = new Layout();
+        for (size_t s = 1; s < shard_target; ++s)
+        {
+            const T &bound = sample[s * sample.size() / shard_target];
+            if (next->bounds.empty() || next->bounds.back() < bound)
+                next->bounds.push_back(bound);
+        }
+        for (size_t s = 0; s <= next->bounds.size(); ++s)
+            next->shards.push_back(newShard());
+        publish(next);
+        only->retired = true;
+    }
+
+    // Public Methods
+    template <typename T>
+    template <typename Iterator>
+    void ShardedMultiSet<T>::insert(Iterator begin, Iterator end)
+    {
+        std::vector<T> batch(begin, end);
+        if (batch.empty())
+            return;
+        if (batch.size() >= min_shard_size && layout.load(std::memory_order_acquire)->shards.size() == 1)
+            seed(batch);
+
+        // Partition by the current layout, then bulk-insert each piece into
+        // its shard in parallel. A piece whose shard was retired meanwhile
+        // falls back to routed single inserts.
+        const Layout *l = layout.load(std::memory_order_acquire);
+        std::vector<std::vector<T> > pieces(l->shards.size());
+        for (size_t k = 0; k < batch.size(); ++k)
+            pieces[l->index(batch[k])].push_back(batch[k]);
+        std::vector<T>().swap(batch);
+
+        std::vector<size_t> sizes(pieces.size(), 0);
+        auto apply = [this, l, &pieces, &sizes](size_t s) {
+            Shard *shard = l->shards[s];
+            {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                if (!shard->retired)
+                {
+                    shard->set.insert(pieces[s].begin(), pieces[s].end());
+                    sizes[s] = shard->set.size();
+                    return;
+                }
+            }
+            for (size_t k = 0; k < pieces[s].size(); ++k)
+                insert(pieces[s][k]);
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t s = 0; s < pieces.size(); ++s)
+        {
+            if (pieces[s].empty())
+                continue;
+            if (pieces[s].size() >= parallel_batch)
+                workers.push_back(std::thread(apply, s));
+            else
+                apply(s);
+        }
+        for (size_t w = 0; w < workers.size(); ++w)
+            workers[w].join();
+
+        for (size_t s = 0; s < pieces.size(); ++s)
+        {
+            if (sizes[s])
+                maybeRebalance(l->shards[s], sizes[s]);
+        }
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::insert(const T &key)
+    {
+        insert_multiple(key, 1);
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::insert_multiple(const T &key, size_t amount)
+    {
+        Shard *shard = acquire(key);
+        shard->set.insert_multiple(key, amount);
+        size_t shard_size = shard->set.size();
+        shard->mutex.unlock();
+        maybeRebalance(shard, shard_size);
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::remove(const T &key)
+    {
+        remove_multiple(key, 1);
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::remove_multiple(const T &key, size_t amount)
+    {
+        Shard *shard = acquire(key);
+        shard->set.remove_multiple(key, amount);
+        size_t shard_size = shard->set.size();
+        shard->mutex.unlock();
+        maybeRebalance(shard, shard_size);
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::remove_all(const T &key)
+    {
+        Shard *shard = acquire(key);
+        shard->set.remove_all(key);
+        size_t shard_size = shard->set.size();
+        shard->mutex.unlock();
+        maybeRebalance(shard, shard_size);
+    }
+
+    template <typename T>
+    size_t ShardedMultiSet<T>::count(const T &key) const
+    {
+        Shard *shard = acquire(key);
+        std::lock_guard<std::mutex> lock(shard->mutex, std::adopt_lock);
+        return shard->set.count(key);
+    }
+
+    template <typename T>
+    bool ShardedMultiSet<T>::contains(const T &key) const
+    {
+        Shard *shard = acquire(key);
+        std::lock_guard<std::mutex> lock(shard->mutex, std::adopt_lock);
+        return shard->set.contains(key);
+    }
+
+    template <typename T>
+    T ShardedMultiSet<T>::min() const
+    {
+        const Layout *l = acquireAll();
+        for (size_t s = 0; s < l->shards.size(); ++s)
+        {
+            if (!l->shards[s]->set.empty())
+            {
+                T result = l->shards[s]->set.min();
+                releaseAll(l);
+                return result;
+            }
+        }
+        releaseAll(l);
+        throw std::runtime_error("Tree is empty");
+    }
+
+    template <typename T>
+    T ShardedMultiSet<T>::max() const
+    {
+        const Layout *l = acquireAll();
+        for (size_t s = l->shards.size(); s-- > 0;)
+        {
+            if (!l->shards[s]->set.empty())
+            {
+                T result = l->shards[s]->set.max();
+                releaseAll(l);
+                return result;
+            }
+        }
+        releaseAll(l);
+        throw std::runtime_error("Tree is empty");
+    }
+
+    template <typename T>
+    size_t ShardedMultiSet<T>::size() const
+    {
+        const Layout *l = acquireAll();
+        size_t total = 0;
+        for (size_t s = 0; s < l->shards.size(); ++s)
+            total += l->shards[s]->set.size();
+        releaseAll(l);
+        return total;
+    }
+
+    template <typename T>
+    bool ShardedMultiSet<T>::empty() const
+    {
+        return size() == 0;
+    }
+
+    template <typename T>
+    size_t ShardedMultiSet<T>::shard_count() const
+    {
+        return layout.load(std::memory_order_acquire)->shards.size();
+    }
+
+    template <typename T>
+    void ShardedMultiSet<T>::clear()
+    {
+        const Layout *l = acquireAll();
+        for (size_t s = 0; s < l->shards.size(); ++s)
+            l->shards[s]->set.clear();
+        releaseAll(l);
+    }
+
+    template <typename T>
+    std::vector<T> ShardedMultiSet<T>::to_vector() const
+    {
+        std::vector<T> result;
+        for_each([&result](const T &key) { result.push_back(key); });
+        return result;
+    }
+
+    // Visit every element in order against a consistent snapshot; all
+    // shards stay locked for the duration.
+    template <typename T>
+    template <typename Visitor>
+    void ShardedMultiSet<T>::for_each(Visitor visit) const
+    {
+        const Layout *l = acquireAll();
+        try
+        {
+            for (size_t s = 0; s < l->shards.size(); ++s)
+            {
+                const MultiSet<T> &set = l->shards[s]->set;
+                if (set.empty())
+                    continue;
+                for (typename MultiSet<T>::Finger f = set.finger(set.min()); f.valid(); f.next())
+                {
+                    for (size_t c = 0; c < f.count(); ++c)
+                        visit(f.key());
+                }
+            }
+        }
+        catch (...)
+        {
+            releaseAll(l);
+            throw;
+        }
+        releaseAll(l);
+    }
+
+} // namespace AVLTree
+
+#endif // SHARDED_MULTISET_HPP
@@ -0,0 +1,870 @@
+#ifndef SHARED_MULTISET_HPP
+#define SHARED_MULTISET_HPP
+
+#include <new>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "avl_core.hpp"
+#include "multiset.hpp"
+
+namespace AVLTree
+{
+
+    // Pointer stored as the distance from its own address, so a structure
+    // built from them is valid wherever its memory is mapped. Copies
+    // re-encode the target relative to their own location; 0 is null.
+    template <typename N>
+    class OffsetPtr
+    {
+    public:
+        OffsetPtr() : offset(0) {}
+        OffsetPtr(N *target) { set(target); }
+        OffsetPtr(const OffsetPtr &other) { set(other.get()); }
+        OffsetPtr &operator=(const OffsetPtr &other)
+        {
+            set(other.get());
+            return *this;
+        }
+        OffsetPtr &operator=(N *target)
+        {
+            set(target);
+            return *this;
+        }
+
+        N *get() const
+        {
+            return offset == 0 ? nullptr : reinterpret_cast<N *>(reinterpret_cast<intptr_t>(this) + offset);
+        }
+        operator N *() const { return get(); }
+        N *operator->() const { return get(); }
+
+    private:
+        intptr_t offset;
+
+        void set(N *target)
+        {
+            offset = target ? reinterpret_cast<intptr_t>(target) - reinterpret_cast<intptr_t>(this) : 0;
+        }
+    };
+
+    enum class SharedAccess
+    {
+        ReadOnly,
+        ReadWrite
+    };
+
+    // MultiSet whose nodes live in a memory-mapped segment shared between
+    // processes: one writer maintains the tree, any number of readers map
+    // the same file read-only and query it without copying anything. The
+    // writer holds an exclusive flock() on the file, so a second writer is
+    // refused instead of corrupting the tree.
+    //
+    // The segment is a header followed by a fixed array of node slots.
+    // Children are OffsetPtrs, so every process can map it at a different
+    // address; freed slots go on a free list threaded through `left`.
+    // Writers bump a sequence number to odd before touching the tree and
+    // back to even afterwards (a seqlock). Readers run each query between
+    // two reads of the sequence and retry when it was odd or changed, so
+    // they never block the writer and never see a half-applied update.
+    // While racing a write, a reader may follow a stale pointer; every
+    // pointer is checked to hit a slot of the segment and walks are depth
+    // bounded, so such a reader wastes a retry but cannot fault or loop;
+    // the same failure with no write in progress means the segment is
+    // corrupt and throws. A writer that dies mid-update leaves the
+    // sequence odd: readers that see the same odd value for longer than
+    // the stall timeout and find the writer lock free throw, and new
+    // writers refuse to open the segment.
+    //
+    // Put the segment under /dev/shm for POSIX shared memory, or on any
+    // file system for a file-backed one. Creating a segment replaces the
+    // file; readers still mapping the old one keep their last view. Keys
+    // are stored as raw bytes, so T must be trivially copyable, and the
+    // segment only works between processes built with the same layout.
+    // Capacity is a fixed node count: inserts into a full segment throw
+    // std::length_error and leave the tree unchanged, range inserts
+    // included.
+    template <typename T>
+    class SharedMultiSet
+    {
+    public:
+        SharedMultiSet(const std::string &path, size_t capacity);
+        explicit SharedMultiSet(const std::string &path, SharedAccess access = SharedAccess::ReadOnly);
+        ~SharedMultiSet();
+
+        template <typename Iterator>
+        void insert(Iterator begin, Iterator end);
+        void insert(const T &key);
+        void insert_multiple(const T &key, size_t amount);
+        void remove(const T &key);
+        void remove_multiple(const T &key, size_t amount);
+        void remove_all(const T &key);
+        void clear();
+
+        size_t count(const T &key) const;
+        bool contains(const T &key) const;
+        T min() const;
+        T max() const;
+        size_t size() const;
+        bool empty() const;
+        size_t distinct_size() const;
+        std::vector<T> to_vector() const;
+
+        bool writable() const;
+        size_t capacity() const;
+        size_t segment_bytes() const;
+        uint64_t version() const;
+        MemoryUsage memory_usage() const;
+        void set_stall_timeout(std::chrono::milliseconds timeout);
+
+    private:
+        struct Node
+        {
+            T key;
+            size_t count;
+            short height;
+            OffsetPtr<Node> left;
+            OffsetPtr<Node> right;
+            Node(const T &k, size_t c) : key(k), count(c), height(1) {}
+
+            static void refresh(Node *) {}
+        };
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t key_size;
+            uint32_t node_size;
+            uint64_t capacity;
+            std::atomic<uint64_t> sequence;
+            OffsetPtr<Node> root;
+            OffsetPtr<Node> free_list;
+            uint64_t used_slots; // slots ever handed out; the rest are untouched
+            uint64_t distinct_count;
+            uint64_t total_count;
+        };
+
+        // Ends the write section however the update leaves.
+        class WriteScope
+        {
+        public:
+            explicit WriteScope(Header *header);
+            ~WriteScope();
+
+        private:
+            Header *header;
+        };
+
+        static const size_t max_depth = 128; // far above any AVL tree that fits in memory
+
+        std::string path;
+        int fd;
+        bool writer;
+        char *base;
+        size_t mapped_bytes;
+        Header *header;
+        Node *slots;
+        size_t slot_count;
+        size_t bulk_peak_bytes;
+        std::chrono::milliseconds stall_timeout;
+
+        SharedMultiSet(const SharedMultiSet &);
+        SharedMultiSet &operator=(const SharedMultiSet &);
+
+        static void fail(const std::string &what);
+        static size_t slotsOffset();
+        void map(int prot);
+        void lockWriter();
+        void requireWriter() const;
+        bool resolve(const OffsetPtr<Node> &ptr, const Node *&node) const;
+        bool writerAlive() const;
+        template <typename Query>
+        void readConsistent(Query query) const;
+        const Node *findNode(const T &key, bool &ok) const;
+        Node *createNode(const T &key, size_t amount);
+        void destroyNode(Node *node);
+        Node *buildFromSorted(const std::vector<std::pair<T, size_t> > &entries, size_t lo, size_t hi);
+        Node *insert(Node *node, const T &key, size_t amount);
+        Node *remove(Node *node, const T &key, size_t amount);
+        void collect(std::vector<std::pair<T, size_t> > &entries) const;
+    };
+
+    template <typename T>
+    const size_t SharedMultiSet<T>::max_depth;
+
+    // Constructor and Destructor
+
+    // Create a new, empty segment with room for `capacity` distinct keys
+    // and open it for writing.
+    template <typename T>
+    SharedMultiSet<T>::SharedMultiSet(const std::string &path, size_t capacity)
+        : path(path), fd(-1), writer(true), base(nullptr), mapped_bytes(0), header(nullptr), slots(nullptr),
+          slot_count(capacity), bulk_peak_bytes(0), stall_timeout(std::chrono::seconds(5))
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Shared keys are stored as raw bytes");
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The sequence must be lock-free to work across processes");
+        if (capacity == 0)
+            throw std::invalid_argument("Shared segment needs capacity for at least one node");
+
+        ::unlink(path.c_str());
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+            fail("open " + path);
+        lockWriter();
+        mapped_bytes = slotsOffset() + capacity * sizeof(Node);
+        if (::ftruncate(fd, mapped_bytes) != 0)
+        {
+            ::close(fd);
+            fail("truncate " + path);
+        }
+        map(PROT_READ | PROT_WRITE);
+
+        header = new (base) Header();
+        std::memcpy(header->magic, "AVLSHM1", 8);
+        header->key_size = sizeof(T);
+        header->node_size = sizeof(Node);
+        header->capacity = capacity;
+        header->sequence.store(0, std::memory_order_relaxed);
+        header->used_slots = 0;
+        header->distinct_count = 0;
+        header->total_count = 0;
+        slots = reinterpret_cast<Node *>(base + slotsOffset());
+    }
+
+    // Map an existing segment. ReadWrite takes over as its writer; only one
+    // process may write at a time.
+    template <typename T>
+    SharedMultiSet<T>::SharedMultiSet(const std::string &path, SharedAccess access)
+        : path(path), fd(-1), writer(access == SharedAccess::ReadWrite), base(nullptr), mapped_bytes(0),
+          header(nullptr), slots(nullptr), slot_count(0), bulk_peak_bytes(0),
+          stall_timeout(std::chrono::seconds(5))
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Shared keys are stored as raw bytes");
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The sequence must be lock-free to work across processes");
+        fd = ::open(path.c_str(), writer ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            fail("open " + path);
+        if (writer)
+            lockWriter();
+        struct stat info;
+        if (::fstat(fd, &info) != 0)
+        {
+            ::close(fd);
+            fail("stat " + path);
+        }
+        mapped_bytes = static_cast<size_t>(info.st_size);
+        if (mapped_bytes < sizeof(Header))
+        {
+            ::close(fd);
+            throw std::runtime_error("Shared segment " + path + " has an incompatible format");
+        }
+        map(writer ? PROT_READ | PROT_WRITE : PROT_READ);
+
+        header = reinterpret_cast<Header *>(base);
+        slots = reinterpret_cast<Node *>(base + slotsOffset());
+        slot_count = header->capacity;
+        if (std::memcmp(header->magic, "AVLSHM1", 8) != 0 || header->key_size != sizeof(T) ||
+            header->node_size != sizeof(Node) || mapped_bytes < slotsOffset() + slot_count * sizeof(Node))
+        {
+            ::munmap(base, mapped_bytes);
+            ::close(fd);
+            throw std::runtime_error("Shared segment " + path + " has an incompatible format");
+        }
+        if (writer && (header->sequence.load(std::memory_order_acquire) & 1))
+        {
+            ::munmap(base, mapped_bytes);
+            ::close(fd);
+            throw std::runtime_error("Shared segment " + path + " was left mid-update by its last writer");
+        }
+    }
+
+    template <typename T>
+    SharedMultiSet<T>::~SharedMultiSet()
+    {
+        ::munmap(base, mapped_bytes);
+        if (writer)
+            ::flock(fd, LOCK_UN);
+        ::close(fd);
+    }
+
+    template <typename T>
+    SharedMultiSet<T>::WriteScope::WriteScope(Header *header) : header(header)
+    {
+        header->sequence.store(header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    template <typename T>
+    SharedMultiSet<T>::WriteScope::~WriteScope()
+    {
+        header->sequence.store(header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Private Helper Methods
+    template <typename T>
+    void SharedMultiSet<T>::fail(const std::string &what)
+    {
+        throw std::runtime_error("SharedMultiSet: " + what + ": " + std::strerror(errno));
+    }
+
+    // Slots start on a cache line after the header.
+    template <typename T>
+    size_t SharedMultiSet<T>::slotsOffset()
+    {
+        return (sizeof(Header) + 63) & ~static_cast<size_t>(63);
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::map(int prot)
+    {
+        void *memory = ::mmap(nullptr, mapped_bytes, prot, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED)
+        {
+            ::close(fd);
+            fail("mmap " + path);
+        }
+        base = static_cast<char *>(memory);
+    }
+
+    // Take the writer lock without waiting; closes fd on failure.
+    template <typename T>
+    void SharedMultiSet<T>::lockWriter()
+    {
+        if (::flock(fd, LOCK_EX | LOCK_NB) == 0)
+            return;
+        int error = errno;
+        ::close(fd);
+        if (error == EWOULDBLOCK)
+            throw std::runtime_error("Shared segment " + path + " already has a writer");
+        errno = error;
+        fail("lock " + path);
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::requireWriter() const
+    {
+        if (!writer)
+            throw std::logic_error("Shared segment " + path + " is mapped read-only");
+    }
+
+    // Follow ptr, failing unless it is null or points at a slot.
+    template <typename T>
+    bool SharedMultiSet<T>::resolve(const OffsetPtr<Node> &ptr, const Node *&node) const
+    {
+        node = ptr.get();
+        if (node == nullptr)
+            return true;
+        uintptr_t address = reinterpret_cast<uintptr_t>(node);
+        uintptr_t first = reinterpret_cast<uintptr_t>(slots);
+        return address >= first && address - first < slot_count * sizeof(Node) &&
+               (address - first) % sizeof(Node) == 0;
+    }
+
+    // True unless no process holds the writer lock: a shared lock is only
+    // granted once the writer's exclusive one is gone.
+    template <typename T>
+    bool SharedMultiSet<T>::writerAlive() const
+    {
+        if (::flock(fd, LOCK_SH | LOCK_NB) != 0)
+            return errno == EWOULDBLOCK;
+        ::flock(fd, LOCK_UN);
+        return false;
+    }
+
+    // Run query() until it completes (returns true) without a write
+    // overlapping it. Only the writer changes the tree, so its own reads
+    // always succeed on the first pass. An odd sequence held past the
+    // stall timeout is only fatal once the writer lock is free too, i.e.
+    // the writer died mid-update; a live one may just be rebuilding a
+    // large segment. A query that fails twice with no write in between
+    // met a corrupt segment, and retrying would never end.
+    template <typename T>
+    template <typename Query>
+    void SharedMultiSet<T>::readConsistent(Query query) const
+    {
+        uint64_t stalled = 0;
+        std::chrono::steady_clock::time_point since;
+        bool failed_before = false;
+        for (unsigned attempt = 0;; ++attempt)
+        {
+            if (attempt >= 64)
+                std::this_thread::yield();
+            uint64_t sequence = header->sequence.load(std::memory_order_acquire);
+            if (sequence & 1)
+            {
+                if (attempt < 64)
+                    continue;
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if (sequence != stalled)
+                {
+                    stalled = sequence;
+                    since = now;
+                }
+                else if (now - since > stall_timeout)
+                {
+                    if (!writer && !writerAlive())
+                        throw std::runtime_error("Shared segment " + path + " was left mid-update by its last writer");
+                    since = now;
+                }
+                continue;
+            }
+            bool ok = query();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->sequence.load(std::memory_order_relaxed) != sequence)
+                continue;
+            if (ok)
+                return;
+            if (failed_before)
+                throw std::runtime_error("Shared segment " + path + " is corrupt");
+            failed_before = true;
+        }
+    }
+
+    template <typename T>
+    const typename SharedMultiSet<T>::Node *SharedMultiSet<T>::findNode(const T &key, bool &ok) const
+    {
+        const Node *node;
+        ok = resolve(header->root, node);
+        for (size_t depth = 0; ok && node; ++depth)
+        {
+            if (depth == max_depth)
+                ok = false;
+            else if (key < node->key)
+                ok = resolve(node->left, node);
+            else if (node->key < key)
+                ok = resolve(node->right, node);
+            else
+                return node;
+        }
+        return nullptr;
+    }
+
+    template <typename T>
+    typename SharedMultiSet<T>::Node *SharedMultiSet<T>::createNode(const T &key, size_t amount)
+    {
+        Node *node = header->free_list;
+        if (node)
+            header->free_list = node->left;
+        else if (header->used_slots < slot_count)
+            node = slots + header->used_slots++;
+        else
+            throw std::length_error("Shared segment " + path + " is full");
+        return new (node) Node(key, amount);
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::destroyNode(Node *node)
+    {
+        node->left = header->free_list;
+        header->free_list = node;
+    }
+
+    // Entry i goes in slot i, so in-order walks read the segment front to
+    // back until updates start reusing slots.
+    template <typename T>
+    typename SharedMultiSet<T>::Node *SharedMultiSet<T>::buildFromSorted(const std::vector<std::pair<T, size_t> > &entries, size_t lo, size_t hi)
+    {
+        if (lo >= hi)
+            return nullptr;
+
+        size_t mid = lo + (hi - lo) / 2;
+        Node *node = new (slots + mid) Node(entries[mid].first, entries[mid].second);
+        node->left = buildFromSorted(entries, lo, mid);
+        node->right = buildFromSorted(entries, mid + 1, hi);
+        detail::updateNode(node);
+
+        return node;
+    }
+
+    template <typename T>
+    typename SharedMultiSet<T>::Node *SharedMultiSet<T>::insert(Node *node, const T &key, size_t amount)
+    {
+        if (node == nullptr)
+        {
+            Node *newNode = createNode(key, amount);
+            header->distinct_count++;
+            header->total_count += amount;
+            return newNode;
+        }
+
+        if (key < node->key)
+            node->left = insert(node->left, key, amount);
+        else if (node->key < key)
+            node->right = insert(node->right, key, amount);
+        else
+        {
+            node->count += amount;
+            header->total_count += amount;
+            return node;
+        }
+
+        return detail::rebalance(node);
+    }
+
+    template <typename T>
+    typename SharedMultiSet<T>::Node *SharedMultiSet<T>::remove(Node *node, const T &key, size_t amount)
+    {
+        if (node == nullptr)
+            return node;
+
+        if (key < node->key)
+            node->left = remove(node->left, key, amount);
+        else if (node->key < key)
+            node->right = remove(node->right, key, amount);
+        else if (amount < node->count)
+        {
+            node->count -= amount;
+            header->total_count -= amount;
+            return node;
+        }
+        else if (node->left == nullptr || node->right == nullptr)
+        {
+            header->total_count -= node->count;
+            header->distinct_count--;
+            Node *child = node->left ? node->left : node->right;
+            destroyNode(node);
+            return child;
+        }
+        else
+        {
+            // Two children: take over the inorder successor, then remove it
+            Node *successor = node->right;
+            while (successor->left)
+                successor = successor->left;
+            header->total_count = header->total_count + successor->count - node->count;
+            node->key = successor->key;
+            node->count = successor->count;
+            node->right = remove(node->right, successor->key, successor->count);
+        }
+
+        return detail::rebalance(node);
+    }
+
+    // Consistent in-order (key, count) list of the whole tree.
+    template <typename T>
+    void SharedMultiSet<T>::collect(std::vector<std::pair<T, size_t> > &entries) const
+    {
+        std::vector<const Node *> stack;
+        readConsistent([&]() {
+            entries.clear();
+            stack.clear();
+            const Node *node;
+            if (!resolve(header->root, node))
+                return false;
+            while (node || !stack.empty())
+            {
+                while (node)
+                {
+                    if (stack.size() == max_depth)
+                        return false;
+                    stack.push_back(node);
+                    if (!resolve(node->left, node))
+                        return false;
+                }
+                node = stack.back();
+                stack.pop_back();
+                if (entries.size() == slot_count)
+                    return false;
+                entries.push_back(std::make_pair(node->key, node->count));
+                if (!resolve(node->right, node))
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    // Public Methods
+    template <typename T>
+    template <typename Iterator>
+    void SharedMultiSet<T>::insert(Iterator begin, Iterator end)
+    {
+        requireWriter();
+        // If bulk is small compared to tree size, do individual insertions.
+        // Unless the free slots cover every key, count the new distinct
+        // keys first so a full segment rejects the whole range.
+        size_t bulk_size = std::distance(begin, end);
+        if (bulk_size <= size() / 2)
+        {
+            size_t free_slots = slot_count - distinct_size();
+            if (bulk_size > free_slots)
+            {
+                std::vector<T> keys(begin, end);
+                std::sort(keys.begin(), keys.end());
+                size_t fresh = 0;
+                for (size_t i = 0; i < keys.size(); ++i)
+                {
+                    if ((i == 0 || keys[i - 1] < keys[i]) && !contains(keys[i]))
+                        fresh++;
+                }
+                if (fresh > free_slots)
+                    throw std::length_error("Shared segment " + path + " is full");
+            }
+            for (Iterator it = begin; it != end; ++it)
+                insert(*it);
+            return;
+        }
+
+        std::vector<T> bulk(begin, end);
+        std::sort(bulk.begin(), bulk.end());
+        std::vector<std::pair<T, size_t> > current;
+        current.reserve(distinct_size());
+        collect(current);
+
+        // Merge the existing entries with the sorted bulk, coalescing duplicates
+        std::vector<std::pair<T, size_t> > merged;
+        merged.reserve(current.size() + bulk_size);
+        size_t c = 0;
+        for (size_t i = 0; i < bulk.size() || c < current.size();)
+        {
+            std::pair<T, size_t> next;
+            if (i == bulk.size() || (c < current.size() && current[c].first < bulk[i]))
+                next = current[c++];
+            else
+                next = std::make_pair(bulk[i++], static_cast<size_t>(1));
+            if (!merged.empty() && !(merged.back().first < next.first))
+                merged.back().second += next.second;
+            else
+                merged.push_back(next);
+        }
+        size_t peak = bulk.capacity() * sizeof(T) + (current.capacity() + merged.capacity()) * sizeof(std::pair<T, size_t>);
+        bulk_peak_bytes = std::max(bulk_peak_bytes, peak);
+        if (merged.size() > slot_count)
+            throw std::length_error("Shared segment " + path + " is full");
+
+        // Readers retry until the rebuilt tree is published
+        WriteScope scope(header);
+        header->root = buildFromSorted(merged, 0, merged.size());
+        header->free_list = nullptr;
+        header->used_slots = merged.size();
+        header->distinct_count = merged.size();
+        header->total_count += bulk_size;
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::insert(const T &key)
+    {
+        insert_multiple(key, 1);
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::insert_multiple(const T &key, size_t amount)
+    {
+        requireWriter();
+        if (amount == 0)
+            return;
+        WriteScope scope(header);
+        header->root = insert(header->root, key, amount);
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::remove(const T &key)
+    {
+        remove_multiple(key, 1);
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::remove_multiple(const T &key, size_t amount)
+    {
+        requireWriter();
+        if (amount == 0)
+            return;
+        WriteScope scope(header);
+        header->root = remove(header->root, key, amount);
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::remove_all(const T &key)
+    {
+        requireWriter();
+        size_t amount = count(key);
+        if (amount == 0)
+            return;
+        WriteScope scope(header);
+        header->root = remove(header->root, key, amount);
+    }
+
+    template <typename T>
+    void SharedMultiSet<T>::clear()
+    {
+        requireWriter();
+        WriteScope scope(header);
+        header->root = nullptr;
+        header->free_list = nullptr;
+        header->used_slots = 0;
+        header->distinct_count = 0;
+        header->total_count = 0;
+    }
+
+    template <typename T>
+    size_t SharedMultiSet<T>::count(const T &key) const
+    {
+        size_t result = 0;
+        readConsistent([&]() {
+            bool ok;
+            const Node *node = findNode(key, ok);
+            result = node ? node->count : 0;
+            return ok;
+        });
+        return result;
+    }
+
+    template <typename T>
+    bool SharedMultiSet<T>::contains(const T &key) const
+    {
+        return count(key) > 0;
+    }
+
+    template <typename T>
+    T SharedMultiSet<T>::min() const
+    {
+        T result = T();
+        bool found = false;
+        readConsistent([&]() {
+            const Node *node;
+            if (!resolve(header->root, node))
+                return false;
+            found = node != nullptr;
+            for (size_t depth = 0; node; ++depth)
+            {
+                result = node->key;
+                if (depth == max_depth || !resolve(node->left, node))
+                    return false;
+            }
+            return true;
+        });
+        if (!found)
+            throw std::runtime_error("Tree is empty");
+        return result;
+    }
+
+    template <typename T>
+    T SharedMultiSet<T>::max() const
+    {
+        T result = T();
+        bool found = false;
+        readConsistent([&]() {
+            const Node *node;
+            if (!resolve(header->root, node))
+                return false;
+            found = node != nullptr;
+            for (size_t depth = 0; node; ++depth)
+            {
+                result = node->key;
+                if (depth == max_depth || !resolve(node->right, node))
+                    return false;
+            }
+            return true;
+        });
+        if (!found)
+            throw std::runtime_error("Tree is empty");
+        return result;
+    }
+
+    template <typename T>
+    size_t SharedMultiSet<T>::size() const
+    {
+        size_t result = 0;
+        readConsistent([&]() {
+            result = header->total_count;
+            return true;
+        });
+        return result;
+    }
+
+    template <typename T>
+    bool SharedMultiSet<T>::empty() const
+    {
+        return size() == 0;
+    }
+
+    template <typename T>
+    size_t SharedMultiSet<T>::distinct_size() const
+    {
+        size_t result = 0;
+        readConsistent([&]() {
+            result = header->distinct_count;
+            return true;
+        });
+        return result;
+    }
+
+    template <typename T>
+    std::vector<T> SharedMultiSet<T>::to_vector() const
+    {
+        std::vector<std::pair<T, size_t> > entries;
+        collect(entries);
+        std::vector<T> result;
+        for (size_t i = 0; i < entries.size(); ++i)
+            result.insert(result.end(), entries[i].second, entries[i].first);
+        return result;
+    }
+
+    template <typename T>
+    bool SharedMultiSet<T>::writable() const
+    {
+        return writer;
+    }
+
+    template <typename T>
+    size_t SharedMultiSet<T>::capacity() const
+    {
+        return slot_count;
+    }
+
+    template <typename T>
+    size_t SharedMultiSet<T>::segment_bytes() const
+    {
+        return mapped_bytes;
+    }
+
+    // Changes once per completed update; readers can compare it to tell
+    // whether anything they derived from the set is stale.
+    template <typename T>
+    uint64_t SharedMultiSet<T>::version() const
+    {
+        return header->sequence.load(std::memory_order_acquire) / 2;
+    }
+
+    // Slots never handed out are sparse in the file and cost no memory
+    // until first used, so they are not counted as slack.
+    template <typename T>
+    MemoryUsage SharedMultiSet<T>::memory_usage() const
+    {
+        size_t distinct = 0, used = 0;
+        readConsistent([&]() {
+            distinct = header->distinct_count;
+            used = header->used_slots;
+            return true;
+        });
+        MemoryUsage usage;
+        usage.node_bytes = distinct * sizeof(Node);
+        usage.allocator_slack = (used - distinct) * sizeof(Node);
+        usage.bookkeeping_bytes = slotsOffset();
+        usage.bulk_peak_bytes = bulk_peak_bytes;
+        return usage;
+    }
+
+    // How long readers wait on a writer stuck mid-update before throwing.
+    template <typename T>
+    void SharedMultiSet<T>::set_stall_timeout(std::chrono::milliseconds timeout)
+    {
+        stall_timeout = timeout;
+    }
+
+} // namespace AVLTree
+
+#endif // SHARED_MULTISET_HPP
@@ -0,0 +1,212 @@
+#ifndef SLIDING_WINDOW_QUANTILE_HPP
+#define SLIDING_WINDOW_QUANTILE_HPP
+
+#include <vector>
+#include <stdexcept>
+#include "multiset.hpp"
+
+namespace AVLTree
+{
+
+    // Quantiles over the last `window` pushed values.
+    //
+    // The window is a ring buffer mirrored in a MultiSet. Every tracked
+    // quantile keeps its current key with the number of values below it
+    // and its multiplicity; a push (and the eviction it causes) shifts that
+    // rank by at most one. Most ticks leave the target rank inside the
+    // key's run and touch no node at all; otherwise the cursor's Finger is
+    // re-anchored if needed and moved a step or two. Each tick is O(log n)
+    // for the tree update, quantile() is O(1).
+    //
+    // Quantile q is the value of rank floor(q * (size() - 1)) in sorted
+    // order, i.e. the lower median for q = 0.5 and an even window.
+    template <typename T>
+    class SlidingWindowQuantile
+    {
+    public:
+        explicit SlidingWindowQuantile(size_t window, const std::vector<double> &quantiles = std::vector<double>(1, 0.5));
+
+        void push(const T &value);
+        T quantile(size_t index = 0) const;
+        size_t tracked() const;
+        size_t size() const;
+        size_t window() const;
+        bool empty() const;
+        void clear();
+
+    private:
+        typedef typename MultiSet<T>::Finger Finger;
+
+        struct Cursor
+        {
+            double q;
+            Finger finger;
+            T key;        // current quantile value
+            size_t below; // number of values < key
+            size_t count; // number of values == key
+            bool placed;
+        };
+
+        MultiSet<T> values;
+        std::vector<T> ring;
+        size_t capacity;
+        size_t head; // oldest value once the ring is full
+        std::vector<Cursor> cursors;
+
+        size_t targetRank(const Cursor &cursor) const;
+        void reposition(Cursor &cursor);
+    };
+
+    // Constructor
+    template <typename T>
+    SlidingWindowQuantile<T>::SlidingWindowQuantile(size_t window, const std::vector<double> &quantiles)
+        : capacity(window), head(0)
+    {
+        if (window == 0)
+            throw std::invalid_argument("Window must not be empty");
+        ring.reserve(window);
+        for (size_t i = 0; i < quantiles.size(); ++i)
+        {
+            if (!(quantiles[i] >= 0.0 && quantiles[i] <= 1.0))
+                throw std::invalid_argument("Quantile must be in [0, 1]");
+            Cursor cursor;
+            cursor.q = quantiles[i];
+            cursor.finger = values.finger();
+            cursor.key = T();
+            cursor.below = 0;
+            cursor.count = 0;
+            cursor.placed = false;
+            cursors.push_back(cursor);
+        }
+    }
+
+    // Private Helper Methods
+    template <typename T>
+    size_t SlidingWindowQuantile<T>::targetRank(const Cursor &cursor) const
+    {
+        return static_cast<size_t>(cursor.q * (values.size() - 1));
+    }
+
+    // If the target rank left the key's run, re-anchor the finger if the
+    // tree changed shape and walk it there. If the cursor's key vanished,
+    // the first key above it has the same number of values below it.
+    template <typename T>
+    void SlidingWindowQuantile<T>::reposition(Cursor &cursor)
+    {
+        size_t target = targetRank(cursor);
+        if (cursor.placed && cursor.below <= target && target < cursor.below + cursor.count)
+            return;
+
+        if (!cursor.placed)
+        {
+            cursor.finger.seek(values.min());
+            cursor.below = 0;
+            cursor.placed = true;
+        }
+        else if (!cursor.finger.valid() || cursor.finger.count() == 0)
+        {
+            if (!cursor.finger.seek(cursor.key) && !cursor.finger.valid())
+            {
+                cursor.finger.seek(values.max());
+                cursor.below = values.size() - cursor.finger.count();
+            }
+        }
+
+        while (target < cursor.below)
+        {
+            cursor.finger.prev();
+            cursor.below -= cursor.finger.count();
+        }
+        while (target >= cursor.below + cursor.finger.count())
+        {
+            cursor.below += cursor.finger.count();
+            cursor.finger.next();
+        }
+        cursor.key = cursor.finger.key();
+        cursor.count = cursor.finger.count();
+    }
+
+    // Public Methods
+    template <typename T>
+    void SlidingWindowQuantile<T>::push(const T &value)
+    {
+        if (ring.size() == capacity)
+        {
+            T evicted = ring[head];
+            ring[head] = value;
+            head = (head + 1) % capacity;
+            values.remove(evicted);
+            for (size_t i = 0; i < cursors.size(); ++i)
+            {
+                if (evicted < cursors[i].key)
+                    cursors[i].below--;
+                else if (evicted == cursors[i].key)
+                    cursors[i].count--;
+            }
+        }
+        else
+        {
+            ring.push_back(value);
+        }
+
+        values.insert(value);
+        for (size_t i = 0; i < cursors.size(); ++i)
+        {
+            if (cursors[i].placed && value < cursors[i].key)
+                cursors[i].below++;
+            else if (cursors[i].placed && value == cursors[i].key)
+                cursors[i].count++;
+            reposition(cursors[i]);
+        }
+    }
+
+    template <typename T>
+    T SlidingWindowQuantile<T>::quantile(size_t index) const
+    {
+        if (ring.empty())
+            throw std::runtime_error("Window is empty");
+        return cursors.at(index).key;
+    }
+
+    template <typename T>
+    size_t SlidingWindowQuantile<T>::tracked() const
+    {
+        return cursors.size();
+    }
+
+    template <typename T>
+    size_t SlidingWindowQuantile<T>::size() const
+    {
+        return ring.size();
+    }
+
+    template <typename T>
+    size_t SlidingWindowQuantile<T>::window() const
+    {
+        return capacity;
+    }
+
+    template <typename T>
+    bool SlidingWindowQuantile<T>::empty() const
+    {
+        return ring.empty();
+    }
+
+    template <typename T>
+    void SlidingWindowQuantile<T>::clear()
+    {
+        values.clear();
+        ring.clear();
+        head = 0;
+        for (size_t i = 0; i < cursors.size(); ++i)
+        {
+            cursors[i].finger = values.finger();
+            cursors[i].below = 0;
+            cursors[i].count = 0;
+            cursors[i].placed = false;
+        }
+    }
+
+} // namespace AVLTree
+
+#endif // SLIDING_WINDOW_QUANTILE_HPP
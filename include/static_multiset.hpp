@@ -0,0 +1,86 @@
+#ifndef STATIC_MULTISET_HPP
+#define STATIC_MULTISET_HPP
+
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include "multiset.hpp"
+
+namespace AVLTree
+{
+
+    // Storage policy keeping up to N nodes inside the tree object itself.
+    // Slots are handed out in order the first time and recycled through a
+    // free list threaded by index through the unused slots, so allocation
+    // and release are O(1) with no heap traffic. Running out of slots
+    // throws std::length_error.
+    template <size_t N>
+    struct InlineStorage
+    {
+        static_assert(N > 0, "InlineStorage needs at least one slot");
+
+        template <typename Node>
+        class pool
+        {
+        public:
+            static const bool bounded = true;
+
+            constexpr pool() : slots(), used(0), free_head(N) {}
+            constexpr size_t capacity() const { return N; }
+
+            void *allocate()
+            {
+                if (free_head != N)
+                {
+                    size_t index = free_head;
+                    std::memcpy(&free_head, &slots[index], sizeof(size_t));
+                    return &slots[index];
+                }
+                if (used == N)
+                    throw std::length_error("Node capacity exceeded");
+                return &slots[used++];
+            }
+
+            void deallocate(void *p)
+            {
+                size_t index = static_cast<Slot *>(p) - slots;
+                std::memcpy(&slots[index], &free_head, sizeof(size_t));
+                free_head = index;
+            }
+
+            // The block is the front of the pool, so this is only valid
+            // while no node is live.
+            void *allocate_block(size_t n)
+            {
+                if (n > N)
+                    throw std::length_error("Node capacity exceeded");
+                used = n;
+                free_head = N;
+                return slots;
+            }
+
+            void deallocate_block(void *, size_t)
+            {
+                used = 0;
+                free_head = N;
+            }
+
+        private:
+            typedef typename std::aligned_storage<sizeof(Node), alignof(Node)>::type Slot;
+            static_assert(sizeof(Slot) >= sizeof(size_t), "free list index must fit in a slot");
+
+            Slot slots[N];
+            size_t used;      // slots handed out at least once
+            size_t free_head; // first recycled slot, N when the free list is empty
+        };
+    };
+
+    // MultiSet whose nodes live in an inline array of N slots: single-key
+    // inserts and removals never touch the heap. Bulk inserts, compact(),
+    // fingers and lazy deletion still use temporary vectors.
+    template <typename T, size_t N, typename Augment = NoAugment>
+    using StaticMultiSet = MultiSet<T, Augment, InlineStorage<N> >;
+
+} // namespace AVLTree
+
+#endif // STATIC_MULTISET_HPP
@@ -0,0 +1,223 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+namespace AVLTree
+{
+
+    enum class TraceOp : unsigned char
+    {
+        Insert = 1,         // key
+        InsertMultiple = 2, // key, amount
+        BulkInsert = 3,     // amount, then `amount` keys
+        Remove = 4,         // key
+        RemoveMultiple = 5, // key, amount
+        RemoveAll = 6,      // key
+        Count = 7,          // key
+        Contains = 8,       // key
+        Min = 9,
+        Max = 10,
+        PopMin = 11,
+        PopMax = 12,
+        Clear = 13
+    };
+
+    namespace detail
+    {
+        inline bool traceHasKey(TraceOp op)
+        {
+            return op <= TraceOp::Contains && op != TraceOp::BulkInsert;
+        }
+
+        inline bool traceHasAmount(TraceOp op)
+        {
+            return op == TraceOp::InsertMultiple || op == TraceOp::BulkInsert || op == TraceOp::RemoveMultiple;
+        }
+    } // namespace detail
+
+    // Binary trace of the public calls made on a MultiSet, for replaying
+    // real workloads (see tools/trace_replay.cpp). A record is one op byte
+    // followed by the raw key and/or a 64-bit amount where the op has
+    // them; the file starts with "AVLT" and sizeof(T). Writes go through
+    // stdio buffering, nothing is synced. T must be trivially copyable.
+    template <typename T>
+    class TraceRecorder
+    {
+    public:
+        explicit TraceRecorder(const std::string &path);
+        ~TraceRecorder();
+
+        void record(TraceOp op, const T &key, uint64_t amount = 1);
+        template <typename Iterator>
+        void record_bulk(Iterator begin, Iterator end);
+        void flush();
+        uint64_t records() const;
+
+    private:
+        std::FILE *file;
+        uint64_t record_count;
+
+        TraceRecorder(const TraceRecorder &);
+        TraceRecorder &operator=(const TraceRecorder &);
+
+        template <typename V>
+        void put(const V &value);
+    };
+
+    template <typename T>
+    struct TraceRecord
+    {
+        TraceOp op;
+        T key;
+        uint64_t amount;
+        size_t bulk_begin; // BulkInsert: index of the first key in TraceReader::bulk_keys
+    };
+
+    // Loads a whole trace into memory so replays time only the tree.
+    template <typename T>
+    class TraceReader
+    {
+    public:
+        explicit TraceReader(const std::string &path);
+
+        std::vector<TraceRecord<T> > records;
+        std::vector<T> bulk_keys;
+
+    private:
+        static const size_t bulk_chunk = 4096; // keys read per step of a BulkInsert
+    };
+
+    template <typename T>
+    const size_t TraceReader<T>::bulk_chunk;
+
+    // Constructor and Destructor
+    template <typename T>
+    TraceRecorder<T>::TraceRecorder(const std::string &path) : file(std::fopen(path.c_str(), "wb")), record_count(0)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Trace keys are stored as raw bytes");
+        if (file == nullptr)
+            throw std::runtime_error("Cannot open trace " + path);
+        std::fwrite("AVLT", 1, 4, file);
+        put(static_cast<uint32_t>(sizeof(T)));
+    }
+
+    template <typename T>
+    TraceRecorder<T>::~TraceRecorder()
+    {
+        std::fclose(file);
+    }
+
+    template <typename T>
+    TraceReader<T>::TraceReader(const std::string &path)
+    {
+        std::FILE *file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr)
+            throw std::runtime_error("Cannot open trace " + path);
+        char magic[4];
+        uint32_t key_size = 0;
+        if (std::fread(magic, 1, 4, file) != 4 || std::string(magic, 4) != "AVLT" ||
+            std::fread(&key_size, sizeof(key_size), 1, file) != 1 || key_size != sizeof(T))
+        {
+            std::fclose(file);
+            throw std::runtime_error("Trace " + path + " has an incompatible format");
+        }
+
+        // A truncated tail (recorder killed mid-write) ends the trace; an
+        // op byte no recorder writes means the file is corrupt
+        int op;
+        while ((op = std::fgetc(file)) != EOF)
+        {
+            if (op < static_cast<int>(TraceOp::Insert) || op > static_cast<int>(TraceOp::Clear))
+            {
+                long offset = std::ftell(file) - 1;
+                std::fclose(file);
+                throw std::runtime_error("Trace " + path + " is corrupt at offset " + std::to_string(offset));
+            }
+            TraceRecord<T> record;
+            record.op = static_cast<TraceOp>(op);
+            record.key = T();
+            record.amount = 1;
+            record.bulk_begin = bulk_keys.size();
+            if (detail::traceHasKey(record.op) && std::fread(&record.key, sizeof(T), 1, file) != 1)
+                break;
+            if (detail::traceHasAmount(record.op) && std::fread(&record.amount, sizeof(uint64_t), 1, file) != 1)
+                break;
+            if (record.op == TraceOp::BulkInsert)
+            {
+                // Read in bounded chunks, so a corrupt amount only grows
+                // bulk_keys as far as the file actually goes
+                uint64_t left = record.amount;
+                while (left > 0)
+                {
+                    size_t chunk = static_cast<size_t>(std::min<uint64_t>(left, bulk_chunk));
+                    size_t at = bulk_keys.size();
+                    bulk_keys.resize(at + chunk);
+                    if (std::fread(bulk_keys.data() + at, sizeof(T), chunk, file) != chunk)
+                        break;
+                    left -= chunk;
+                }
+                if (left > 0)
+                {
+                    bulk_keys.resize(record.bulk_begin);
+                    break;
+                }
+            }
+            records.push_back(record);
+        }
+        std::fclose(file);
+    }
+
+    // Private Helper Methods
+    template <typename T>
+    template <typename V>
+    void TraceRecorder<T>::put(const V &value)
+    {
+        if (std::fwrite(&value, sizeof(V), 1, file) != 1)
+            throw std::runtime_error("Trace write failed");
+    }
+
+    // Public Methods
+    template <typename T>
+    void TraceRecorder<T>::record(TraceOp op, const T &key, uint64_t amount)
+    {
+        put(static_cast<unsigned char>(op));
+        if (detail::traceHasKey(op))
+            put(key);
+        if (detail::traceHasAmount(op))
+            put(amount);
+        record_count++;
+    }
+
+    template <typename T>
+    template <typename Iterator>
+    void TraceRecorder<T>::record_bulk(Iterator begin, Iterator end)
+    {
+        put(static_cast<unsigned char>(TraceOp::BulkInsert));
+        put(static_cast<uint64_t>(std::distance(begin, end)));
+        for (Iterator it = begin; it != end; ++it)
+            put(static_cast<T>(*it));
+        record_count++;
+    }
+
+    template <typename T>
+    void TraceRecorder<T>::flush()
+    {
+        std::fflush(file);
+    }
+
+    template <typename T>
+    uint64_t TraceRecorder<T>::records() const
+    {
+        return record_count;
+    }
+
+} // namespace AVLTree
+
+#endif // TRACE_HPP
@@ -1,10 +1,20 @@
 #include "avl_tree.hpp"
 #include <set>
+#include <map>
+#include <string>
 #include <vector>
 #include <iostream>
 #include <cassert>
 #include <random>
 #include <algorithm>
+#include <limits>
+#include <thread>
+#include <cstdlib>
+#include <type_traits>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 // Helper function to print containers
 template <typename Container>
@@ -158,8 +168,1984 @@ void test_avl_tree()
     std::cout << "All tests passed successfully!" << std::endl;
 }
 
+void test_aggregate()
+{
+    std::cout << "\n=== Starting Aggregate Tests ===" << std::endl;
+
+    AVLTree::MultiSet<long long, AVLTree::SumAugment<long long> > sums;
+    AVLTree::MultiSet<int, AVLTree::MinAugment<int> > mins;
+    std::multiset<long long> reference;
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<> dis(-200, 200);
+    std::uniform_int_distribution<> op_dis(0, 3);
+
+    // Bulk path first so buildFromSorted summaries are covered
+    std::vector<long long> init_data;
+    for (int i = 0; i < 500; ++i)
+        init_data.push_back(dis(gen));
+    sums.insert(init_data.begin(), init_data.end());
+    mins.insert(init_data.begin(), init_data.end());
+    reference.insert(init_data.begin(), init_data.end());
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        int val = dis(gen);
+        switch (op_dis(gen))
+        {
+        case 0:
+            sums.insert(val);
+            mins.insert(val);
+            reference.insert(val);
+            break;
+        case 1:
+            sums.insert_multiple(val, 3);
+            mins.insert_multiple(val, 3);
+            for (int j = 0; j < 3; ++j)
+                reference.insert(val);
+            break;
+        case 2:
+        {
+            sums.remove(val);
+            mins.remove(val);
+            auto it = reference.find(val);
+            if (it != reference.end())
+                reference.erase(it);
+            break;
+        }
+        case 3:
+            sums.remove_all(val);
+            mins.remove_all(val);
+            reference.erase(val);
+            break;
+        }
+
+        int lo = dis(gen);
+        int hi = lo + std::uniform_int_distribution<>(0, 100)(gen);
+        long long expected_sum = 0;
+        int expected_min = std::numeric_limits<int>::max();
+        for (auto it = reference.lower_bound(lo); it != reference.end() && *it <= hi; ++it)
+        {
+            expected_sum += *it;
+            expected_min = std::min(expected_min, static_cast<int>(*it));
+        }
+        assert(sums.aggregate(lo, hi) == expected_sum);
+        assert(mins.aggregate(lo, hi) == expected_min);
+    }
+
+    long long total = 0;
+    for (long long v : reference)
+        total += v;
+    assert(sums.aggregate() == total);
+    assert(sums.aggregate(1, 0) == 0);
+
+    std::cout << "All aggregate tests passed successfully!" << std::endl;
+}
+
+void test_map()
+{
+    std::cout << "\n=== Starting Map Tests ===" << std::endl;
+
+    AVLTree::Map<int, std::string> map;
+    std::map<int, std::string> reference;
+    std::mt19937 gen(2024);
+    std::uniform_int_distribution<> dis(-300, 300);
+    std::uniform_int_distribution<> op_dis(0, 3);
+
+    for (int i = 0; i < 3000; ++i)
+    {
+        int key = dis(gen);
+        std::string value = std::to_string(i);
+        switch (op_dis(gen))
+        {
+        case 0:
+            map[key] += value;
+            reference[key] += value;
+            break;
+        case 1:
+        {
+            auto result = map.insert_or_assign(key, value);
+            bool inserted = reference.find(key) == reference.end();
+            reference[key] = value;
+            assert(result.second == inserted);
+            assert(result.first->first == key && result.first->second == value);
+            break;
+        }
+        case 2:
+            assert(map.erase(key) == reference.erase(key));
+            break;
+        case 3:
+        {
+            auto it = map.find(key);
+            auto ref_it = reference.find(key);
+            assert((it == map.end()) == (ref_it == reference.end()));
+            if (ref_it != reference.end())
+                assert(it->second == ref_it->second);
+            break;
+        }
+        }
+
+        if (i % 100 == 0)
+        {
+            assert(map.size() == reference.size());
+            assert(std::equal(map.begin(), map.end(), reference.begin()));
+
+            // Ordered range iteration over [lo, hi)
+            int lo = dis(gen);
+            int hi = lo + 50;
+            auto it = map.lower_bound(lo);
+            auto ref_it = reference.lower_bound(lo);
+            for (; ref_it != reference.upper_bound(hi - 1); ++it, ++ref_it)
+                assert(it->first == ref_it->first);
+            assert(it == map.upper_bound(hi - 1));
+        }
+    }
+
+    bool threw = false;
+    try
+    {
+        map.at(1000);
+    }
+    catch (const std::out_of_range &)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    // Mutable iterators convert to const ones, never the other way
+    typedef AVLTree::Map<int, std::string> StringMap;
+    static_assert(std::is_convertible<StringMap::iterator, StringMap::const_iterator>::value,
+                  "iterator must convert to const_iterator");
+    static_assert(!std::is_convertible<StringMap::const_iterator, StringMap::iterator>::value,
+                  "const_iterator must not convert to iterator");
+    static_assert(!std::is_constructible<StringMap::iterator, StringMap::const_iterator>::value,
+                  "const_iterator must not convert to iterator");
+
+    map.clear();
+    assert(map.empty() && map.begin() == map.end());
+
+    std::cout << "All map tests passed successfully!" << std::endl;
+}
+
+void test_lazy_deletion()
+{
+    std::cout << "\n=== Starting Lazy Deletion Tests ===" << std::endl;
+
+    AVLTree::MultiSet<int, AVLTree::SumAugment<int> > avl;
+    avl.set_lazy_deletion(true, 0.25);
+    std::multiset<int> reference;
+    std::mt19937 gen(777);
+    std::uniform_int_distribution<> dis(-100, 100);
+    std::uniform_int_distribution<> op_dis(0, 5);
+    size_t max_tombstones = 0;
+
+    for (int i = 0; i < 5000; ++i)
+    {
+        int val = dis(gen);
+        switch (op_dis(gen))
+        {
+        case 0:
+            avl.insert(val);
+            reference.insert(val);
+            break;
+        case 1:
+            avl.insert_multiple(val, 2);
+            reference.insert(val);
+            reference.insert(val);
+            break;
+        case 2:
+        case 3:
+        {
+            avl.remove(val);
+            auto it = reference.find(val);
+            if (it != reference.end())
+                reference.erase(it);
+            break;
+        }
+        case 4:
+            avl.remove_all(val);
+            reference.erase(val);
+            break;
+        case 5:
+            if (!reference.empty())
+            {
+                assert(avl.pop_min() == *reference.begin());
+                reference.erase(reference.begin());
+            }
+            break;
+        }
+
+        max_tombstones = std::max(max_tombstones, avl.tombstone_size());
+        assert(avl.size() == reference.size());
+        assert(avl.contains(val) == (reference.count(val) > 0));
+        assert(avl.count(val) == reference.count(val));
+        if (!reference.empty())
+        {
+            assert(avl.min() == *reference.begin());
+            assert(avl.max() == *reference.rbegin());
+        }
+        if (i % 100 == 0)
+        {
+            assert(avl.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+            std::set<int> distinct(reference.begin(), reference.end());
+            assert(avl.distinct_size() == distinct.size());
+            int sum = 0;
+            for (int v : reference)
+                sum += v;
+            assert(avl.aggregate() == sum);
+        }
+    }
+    assert(max_tombstones > 0);
+
+    avl.set_lazy_deletion(false);
+    assert(avl.tombstone_size() == 0);
+    assert(avl.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+
+    // Draining from both ends leaves tombstone runs at the edges; min and
+    // max must still land on live keys
+    AVLTree::MultiSet<int> drain;
+    drain.set_lazy_deletion(true, 1.0);
+    for (int i = 0; i < 2000; ++i)
+        drain.insert(i);
+    for (int i = 0; i < 900; ++i)
+    {
+        assert(drain.pop_min() == i && drain.pop_max() == 1999 - i);
+        assert(drain.min() == i + 1 && drain.max() == 1998 - i);
+    }
+    assert(drain.tombstone_size() > 0 && drain.size() == 200);
+
+    // A finger resting on a key that becomes a tombstone re-seeks
+    AVLTree::MultiSet<int>::Finger finger = drain.finger(1000);
+    assert(finger.valid() && finger.key() == 1000);
+    drain.remove(1000);
+    assert(!finger.valid());
+    assert(!finger.seek(1000) && finger.key() == 1001 && finger.count() == 1);
+
+    std::cout << "All lazy deletion tests passed successfully!" << std::endl;
+}
+
+void test_finger()
+{
+    std::cout << "\n=== Starting Finger Tests ===" << std::endl;
+
+    // Hinted inserts on sorted, nearly-sorted and random streams
+    std::mt19937 gen(99);
+    for (int pattern = 0; pattern < 3; ++pattern)
+    {
+        AVLTree::MultiSet<int, AVLTree::SumAugment<int> > avl;
+        std::multiset<int> reference;
+        AVLTree::MultiSet<int, AVLTree::SumAugment<int> >::Finger hint = avl.finger();
+        for (int i = 0; i < 3000; ++i)
+        {
+            int val = i;
+            if (pattern == 1)
+                val = i + std::uniform_int_distribution<>(-20, 20)(gen);
+            else if (pattern == 2)
+                val = std::uniform_int_distribution<>(-500, 500)(gen);
+            avl.insert(hint, val);
+            reference.insert(val);
+            assert(hint.valid() && hint.key() == val);
+
+            // Mix in operations that invalidate the finger
+            if (i % 97 == 0)
+            {
+                avl.remove(val);
+                reference.erase(reference.find(val));
+            }
+        }
+        assert(avl.size() == reference.size());
+        assert(avl.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+        assert(avl.min() == *reference.begin());
+        assert(avl.max() == *reference.rbegin());
+        int sum = 0;
+        for (int v : reference)
+            sum += v;
+        assert(avl.aggregate() == sum);
+    }
+
+    // Seek, next and prev against std::set
+    AVLTree::MultiSet<int> avl;
+    std::set<int> reference;
+    for (int i = 0; i < 2000; ++i)
+    {
+        int val = std::uniform_int_distribution<>(0, 5000)(gen);
+        avl.insert(val);
+        reference.insert(val);
+    }
+    AVLTree::MultiSet<int>::Finger f = avl.finger();
+    for (int i = 0; i < 2000; ++i)
+    {
+        int target = std::uniform_int_distribution<>(-10, 5010)(gen);
+        bool found = f.seek(target);
+        auto it = reference.lower_bound(target);
+        assert(found == (it != reference.end() && *it == target));
+        assert(f.valid() == (it != reference.end()));
+        if (it == reference.end())
+            continue;
+        assert(f.key() == *it);
+        if (i % 2 == 0)
+        {
+            bool more = f.next();
+            ++it;
+            assert(more == (it != reference.end()));
+            if (more)
+                assert(f.key() == *it);
+        }
+        else
+        {
+            bool more = f.prev();
+            assert(more == (it != reference.begin()));
+            if (more)
+                assert(f.key() == *std::prev(it));
+        }
+    }
+
+    // Full in-order walk, skipping tombstones
+    avl.set_lazy_deletion(true, 0.9);
+    for (int i = 0; i < 5000; i += 3)
+    {
+        avl.remove_all(i);
+        reference.erase(i);
+    }
+    std::vector<int> walked;
+    f = avl.finger();
+    for (bool ok = f.seek(-1) || f.valid(); ok; ok = f.next())
+        walked.push_back(f.key());
+    assert(walked == std::vector<int>(reference.begin(), reference.end()));
+
+    std::cout << "All finger tests passed successfully!" << std::endl;
+}
+
+void test_compact()
+{
+    std::cout << "\n=== Starting Compact Tests ===" << std::endl;
+
+    std::mt19937 gen(31337);
+    std::uniform_int_distribution<> dis(0, 2000);
+    for (int layout = 0; layout < 2; ++layout)
+    {
+        AVLTree::MultiSet<int, AVLTree::SumAugment<int> > avl;
+        std::multiset<int> reference;
+        avl.set_lazy_deletion(true, 0.5);
+
+        std::vector<int> init_data;
+        for (int i = 0; i < 3000; ++i)
+            init_data.push_back(dis(gen));
+        avl.insert(init_data.begin(), init_data.end());
+        reference.insert(init_data.begin(), init_data.end());
+        assert(avl.memory_usage().bulk_peak_bytes >= init_data.size() * sizeof(int));
+
+        for (int round = 0; round < 4; ++round)
+        {
+            // Churn, then compact and keep going on the recycled arena slots
+            for (int i = 0; i < 3000; ++i)
+            {
+                int val = dis(gen);
+                if (i % 2)
+                {
+                    avl.insert(val);
+                    reference.insert(val);
+                }
+                else
+                {
+                    avl.remove_all(val);
+                    reference.erase(val);
+                }
+            }
+            avl.compact(layout ? AVLTree::NodeLayout::VanEmdeBoas : AVLTree::NodeLayout::InOrder);
+            assert(avl.tombstone_size() == 0);
+            assert(avl.memory_usage().allocator_slack == 0);
+            assert(avl.size() == reference.size());
+            assert(avl.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+            assert(avl.min() == *reference.begin());
+            assert(avl.max() == *reference.rbegin());
+            int sum = 0;
+            for (int v : reference)
+                sum += v;
+            assert(avl.aggregate() == sum);
+            for (int i = 0; i < 200; ++i)
+            {
+                int val = dis(gen);
+                assert(avl.count(val) == reference.count(val));
+            }
+        }
+
+        AVLTree::MemoryUsage usage = avl.memory_usage();
+        assert(usage.node_bytes > 0 && usage.total() >= usage.node_bytes);
+        avl.clear();
+        assert(avl.memory_usage().node_bytes == 0);
+        assert(avl.memory_usage().allocator_slack == 0);
+    }
+
+    std::cout << "All compact tests passed successfully!" << std::endl;
+}
+
+void test_sharded()
+{
+    std::cout << "\n=== Starting Sharded MultiSet Tests ===" << std::endl;
+
+    // Seeded bulk load, then concurrent writers
+    std::vector<int> init_data;
+    std::mt19937 gen(4242);
+    std::uniform_int_distribution<> dis(0, 100000);
+    for (int i = 0; i < 20000; ++i)
+        init_data.push_back(dis(gen));
+    AVLTree::ShardedMultiSet<int> sharded(init_data.begin(), init_data.end(), 8, 256);
+    std::multiset<int> reference(init_data.begin(), init_data.end());
+    assert(sharded.shard_count() > 1);
+
+    const int thread_count = 4;
+    std::vector<std::vector<int> > inserts(thread_count), removes(thread_count);
+    for (int t = 0; t < thread_count; ++t)
+    {
+        for (int i = 0; i < 5000; ++i)
+        {
+            int val = dis(gen);
+            inserts[t].push_back(val);
+            reference.insert(val);
+        }
+        // Each thread removes keys it inserted itself, so the outcome is fixed
+        for (int i = 0; i < 5000; i += 3)
+        {
+            removes[t].push_back(inserts[t][i]);
+            reference.erase(reference.find(inserts[t][i]));
+        }
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < thread_count; ++t)
+    {
+        workers.push_back(std::thread([&sharded, &inserts, &removes, t]() {
+            for (size_t i = 0; i < inserts[t].size(); ++i)
+            {
+                sharded.insert(inserts[t][i]);
+                if (i % 3 == 0)
+                    sharded.remove(inserts[t][i]);
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+    assert(sharded.size() == reference.size());
+    assert(sharded.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+    assert(sharded.min() == *reference.begin());
+    assert(sharded.max() == *reference.rbegin());
+    for (int i = 0; i < 1000; ++i)
+    {
+        int val = dis(gen);
+        assert(sharded.count(val) == reference.count(val));
+        assert(sharded.contains(val) == (reference.count(val) > 0));
+    }
+
+    // Shrinking merges shards back together
+    for (int val : std::vector<int>(reference.begin(), reference.end()))
+        sharded.remove_all(val);
+    assert(sharded.empty());
+    assert(sharded.shard_count() < 8);
+
+    // Growth from empty via single inserts splits shards
+    AVLTree::ShardedMultiSet<int> grown(4, 64);
+    for (int i = 0; i < 5000; ++i)
+        grown.insert(i);
+    assert(grown.shard_count() > 1);
+    assert(grown.size() == 5000 && grown.min() == 0 && grown.max() == 4999);
+
+    // A single hot key cannot be split; writes must not keep retrying
+    AVLTree::ShardedMultiSet<int> hot(4, 64);
+    for (int i = 0; i < 80000; ++i)
+        hot.insert(7);
+    assert(hot.shard_count() == 1 && hot.count(7) == 80000);
+
+    // Once other keys arrive (and the shard has doubled since the last
+    // attempt), a median on the smallest key still splits past it
+    AVLTree::ShardedMultiSet<int> skewed(4, 64);
+    for (int i = 0; i < 1000; ++i)
+        skewed.insert(0);
+    for (int i = 1; i <= 100; ++i)
+        skewed.insert(i);
+    assert(skewed.shard_count() > 1);
+    assert(skewed.count(0) == 1000 && skewed.count(100) == 1 && skewed.size() == 1100);
+
+    std::cout << "All sharded multiset tests passed successfully!" << std::endl;
+}
+
+void test_journal()
+{
+    std::cout << "\n=== Starting Journal Tests ===" << std::endl;
+
+    const std::string path = "journal_test.log";
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+
+    std::multiset<int> reference;
+    std::mt19937 gen(777);
+    std::uniform_int_distribution<> dis(0, 500);
+    {
+        AVLTree::Journal<int> journal(path, 16);
+        AVLTree::MultiSet<int> tree;
+        tree.attach_journal(&journal);
+
+        std::vector<int> bulk;
+        for (int i = 0; i < 2000; ++i)
+            bulk.push_back(dis(gen));
+        tree.insert(bulk.begin(), bulk.end());
+        reference.insert(bulk.begin(), bulk.end());
+        for (int i = 0; i < 3000; ++i)
+        {
+            int val = dis(gen);
+            switch (i % 5)
+            {
+            case 0:
+                tree.insert(val);
+                reference.insert(val);
+                break;
+            case 1:
+                tree.insert_multiple(val, 3);
+                reference.insert(val);
+                reference.insert(val);
+                reference.insert(val);
+                break;
+            case 2:
+                tree.remove(val);
+                if (reference.count(val))
+                    reference.erase(reference.find(val));
+                break;
+            case 3:
+                tree.remove_multiple(val, 2);
+                for (int k = 0; k < 2 && reference.count(val); ++k)
+                    reference.erase(reference.find(val));
+                break;
+            default:
+                tree.remove_all(val);
+                reference.erase(val);
+                break;
+            }
+        }
+
+        // Snapshot, then keep mutating on top of it
+        journal.checkpoint(tree);
+        AVLTree::MultiSet<int>::Finger hint = tree.finger();
+        for (int i = 1000; i < 1100; ++i)
+        {
+            tree.insert(hint, i);
+            reference.insert(i);
+        }
+        tree.pop_min();
+        reference.erase(reference.begin());
+    }
+
+    {
+        AVLTree::Journal<int> journal(path, 16);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        assert(recovered.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+
+        // Recovery leaves the journal attached, clear() is logged too
+        recovered.clear();
+        recovered.insert(42);
+        recovered.insert(7);
+    }
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        assert(recovered.to_vector() == std::vector<int>({7, 42}));
+
+        // A torn record at the tail is ignored
+        recovered.insert(99);
+        journal.sync();
+        recovered.insert_multiple(5, 4);
+    }
+    FILE *file = std::fopen(path.c_str(), "rb+");
+    std::fseek(file, 0, SEEK_END);
+    long length = std::ftell(file);
+    std::fclose(file);
+    assert(truncate(path.c_str(), length - 3) == 0);
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        assert(recovered.to_vector() == std::vector<int>({7, 42, 99}));
+    }
+
+    // An unknown op byte (corruption) ends the replay instead of being
+    // applied as some other op
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        recovered.insert(8);
+        journal.sync();
+    }
+    file = std::fopen(path.c_str(), "rb+");
+    std::fseek(file, -static_cast<long>(1 + sizeof(int)), SEEK_END);
+    std::fputc(0x7f, file);
+    std::fclose(file);
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        assert(recovered.to_vector() == std::vector<int>({7, 42, 99}));
+    }
+
+    // Recovery keeps counts as runs: a huge count costs one node
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+    const size_t huge = size_t(1) << 40;
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> tree;
+        tree.attach_journal(&journal);
+        tree.insert_multiple(5, huge);
+        tree.insert(6);
+        journal.checkpoint(tree);
+        tree.insert_multiple(7, huge);
+        tree.remove_multiple(5, 3);
+        journal.sync();
+    }
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        assert(recovered.distinct_size() == 3 && recovered.size() == 2 * huge - 2);
+        assert(recovered.count(5) == huge - 3 && recovered.count(7) == huge);
+    }
+
+    // Crash after a checkpoint renamed its snapshot but before it truncated
+    // the journal: later writes must still be recovered
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+    std::vector<char> stale_journal;
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> tree;
+        tree.attach_journal(&journal);
+        tree.insert(1);
+        tree.insert(2);
+        journal.sync();
+        FILE *in = std::fopen(path.c_str(), "rb");
+        for (int c; (c = std::fgetc(in)) != EOF;)
+            stale_journal.push_back(static_cast<char>(c));
+        std::fclose(in);
+        journal.checkpoint(tree);
+    }
+    file = std::fopen(path.c_str(), "wb");
+    std::fwrite(stale_journal.data(), 1, stale_journal.size(), file);
+    std::fclose(file);
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        assert(recovered.to_vector() == std::vector<int>({1, 2}));
+        recovered.insert(3);
+        recovered.insert(4);
+        journal.sync();
+    }
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        assert(recovered.to_vector() == std::vector<int>({1, 2, 3, 4}));
+    }
+
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+    std::cout << "All journal tests passed successfully!" << std::endl;
+}
+
+void test_static_multiset()
+{
+    std::cout << "\n=== Starting Static MultiSet Tests ===" << std::endl;
+
+    typedef AVLTree::StaticMultiSet<int, 256> Small;
+    Small *avl = new Small();
+    std::multiset<int> reference;
+    std::mt19937 gen(2024);
+    std::uniform_int_distribution<> dis(0, 399);
+
+    // Random churn near capacity; inserts of new keys past 256 must throw
+    // and leave the tree untouched.
+    size_t rejected = 0;
+    for (int i = 0; i < 20000; ++i)
+    {
+        int val = dis(gen);
+        if (i % 3 == 2)
+        {
+            avl->remove(val);
+            if (reference.count(val))
+                reference.erase(reference.find(val));
+            continue;
+        }
+        try
+        {
+            avl->insert(val);
+            reference.insert(val);
+        }
+        catch (const std::length_error &)
+        {
+            rejected++;
+            assert(avl->distinct_size() == 256 && !reference.count(val));
+        }
+    }
+    assert(rejected > 0);
+    assert(avl->to_vector() == std::vector<int>(reference.begin(), reference.end()));
+    assert(avl->memory_usage().node_bytes + avl->memory_usage().allocator_slack ==
+           avl->memory_usage().node_bytes / avl->distinct_size() * 256);
+
+    // Compaction rebuilds inside the pool, and freed slots are reused
+    avl->compact();
+    assert(avl->to_vector() == std::vector<int>(reference.begin(), reference.end()));
+    int removed = *reference.begin();
+    avl->remove_all(removed);
+    reference.erase(removed);
+    avl->insert(1000);
+    reference.insert(1000);
+    assert(avl->max() == 1000 && avl->to_vector() == std::vector<int>(reference.begin(), reference.end()));
+
+    // An oversized bulk insert fails before touching the tree
+    std::vector<int> bulk;
+    for (int i = 2000; i < 2600; ++i)
+        bulk.push_back(i);
+    bool threw = false;
+    try
+    {
+        avl->insert(bulk.begin(), bulk.end());
+    }
+    catch (const std::length_error &)
+    {
+        threw = true;
+    }
+    assert(threw && avl->size() == reference.size());
+
+    avl->clear();
+    avl->insert(bulk.begin(), bulk.begin() + 256);
+    assert(avl->size() == 256 && avl->min() == 2000 && avl->max() == 2255);
+    delete avl;
+
+    // Augmented variant
+    AVLTree::StaticMultiSet<int, 64, AVLTree::SumAugment<int> > sums;
+    for (int i = 1; i <= 10; ++i)
+        sums.insert_multiple(i, 2);
+    assert(sums.aggregate() == 110 && sums.aggregate(3, 5) == 24);
+
+    std::cout << "All static multiset tests passed successfully!" << std::endl;
+}
+
+void test_sliding_window_quantile()
+{
+    std::cout << "\n=== Starting Sliding Window Quantile Tests ===" << std::endl;
+
+    const double qs[] = {0.0, 0.1, 0.5, 0.99, 1.0};
+    const std::vector<double> quantiles(qs, qs + 5);
+    std::mt19937 gen(99);
+    const size_t windows[] = {1, 7, 100};
+    for (size_t window : windows)
+    {
+        // Narrow value range so duplicates and vanishing keys are common
+        std::uniform_int_distribution<> dis(0, window < 10 ? 5 : 50);
+        AVLTree::SlidingWindowQuantile<int> swq(window, quantiles);
+        std::vector<int> history;
+        for (int i = 0; i < 3000; ++i)
+        {
+            int val = dis(gen);
+            swq.push(val);
+            history.push_back(val);
+
+            size_t n = std::min(history.size(), window);
+            std::vector<int> sorted(history.end() - n, history.end());
+            std::sort(sorted.begin(), sorted.end());
+            assert(swq.size() == n);
+            for (size_t q = 0; q < quantiles.size(); ++q)
+                assert(swq.quantile(q) == sorted[static_cast<size_t>(quantiles[q] * (n - 1))]);
+        }
+    }
+
+    // Sorted drift moves the cursors through every position
+    AVLTree::SlidingWindowQuantile<int> median(10);
+    for (int i = 0; i < 100; ++i)
+    {
+        median.push(i);
+        int lo = std::max(0, i - 9);
+        assert(median.quantile() == lo + (i - lo) / 2);
+    }
+
+    median.clear();
+    assert(median.empty());
+    bool threw = false;
+    try
+    {
+        median.quantile();
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    median.push(5);
+    assert(median.quantile() == 5);
+
+    std::cout << "All sliding window quantile tests passed successfully!" << std::endl;
+}
+
+void test_write_buffer()
+{
+    std::cout << "\n=== Starting Write Buffer Tests ===" << std::endl;
+
+    const size_t capacities[] = {1, 16, 1000};
+    for (size_t capacity : capacities)
+    {
+        AVLTree::MultiSet<int, AVLTree::SumAugment<int> > avl;
+        std::multiset<int> reference;
+        avl.set_write_buffer(capacity);
+        std::mt19937 gen(31337 + capacity);
+        std::uniform_int_distribution<> dis(0, 300);
+        for (int i = 0; i < 20000; ++i)
+        {
+            int val = dis(gen);
+            switch (i % 7)
+            {
+            case 0:
+            case 1:
+            case 2:
+                avl.insert(val);
+                reference.insert(val);
+                break;
+            case 3:
+                avl.insert_multiple(val, 2);
+                reference.insert(val);
+                reference.insert(val);
+                break;
+            case 4:
+                avl.remove(val);
+                if (reference.count(val))
+                    reference.erase(reference.find(val));
+                break;
+            case 5:
+                avl.remove_multiple(val, 3);
+                for (int k = 0; k < 3 && reference.count(val); ++k)
+                    reference.erase(reference.find(val));
+                break;
+            default:
+                avl.remove_all(val);
+                reference.erase(val);
+                break;
+            }
+
+            // Point reads merge the buffer without draining it
+            int probe = dis(gen);
+            assert(avl.count(probe) == reference.count(probe));
+            assert(avl.contains(probe) == (reference.count(probe) > 0));
+            assert(avl.size() == reference.size());
+            if (i % 1000 == 999)
+            {
+                assert(avl.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+                if (!reference.empty())
+                {
+                    assert(avl.min() == *reference.begin() && avl.max() == *reference.rbegin());
+                    long long sum = 0;
+                    for (int v : reference)
+                        sum += v;
+                    assert(avl.aggregate() == sum);
+                }
+            }
+        }
+
+        // Turning the buffer off applies whatever is pending
+        avl.insert(5000);
+        reference.insert(5000);
+        avl.set_write_buffer(0);
+        assert(avl.max() == 5000 && avl.size() == reference.size());
+        assert(avl.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+    }
+
+    // Buffered removals of absent keys are no-ops, as without buffering
+    AVLTree::MultiSet<int> avl;
+    avl.set_write_buffer(8);
+    avl.remove(1);
+    avl.insert(1);
+    assert(avl.count(1) == 1 && avl.size() == 1);
+    avl.clear();
+    assert(avl.empty() && avl.count(1) == 0 && avl.to_vector().empty());
+
+    std::cout << "All write buffer tests passed successfully!" << std::endl;
+}
+
+template <size_t B>
+void check_blocked_multiset(unsigned seed)
+{
+    AVLTree::BlockedMultiSet<int, B> avl;
+    std::multiset<int> reference;
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<> dis(0, 2000);
+
+    std::vector<int> bulk;
+    for (int i = 0; i < 3000; ++i)
+        bulk.push_back(dis(gen));
+    avl.insert(bulk.begin(), bulk.end());
+    reference.insert(bulk.begin(), bulk.end());
+    assert(avl.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+
+    // Grow, then shrink to nothing, so splits and merges both happen
+    for (int phase = 0; phase < 2; ++phase)
+    {
+        for (int i = 0; i < 30000; ++i)
+        {
+            int val = dis(gen);
+            int op = phase == 0 ? i % 4 : i % 3;
+            if (op == 0)
+            {
+                avl.insert(val);
+                reference.insert(val);
+            }
+            else if (op == 1)
+            {
+                avl.remove(val);
+                if (reference.count(val))
+                    reference.erase(reference.find(val));
+            }
+            else if (op == 2)
+            {
+                avl.remove_all(val);
+                reference.erase(val);
+            }
+            else
+            {
+                avl.insert_multiple(val, 2);
+                reference.insert(val);
+                reference.insert(val);
+            }
+            assert(avl.count(val) == reference.count(val));
+            assert(avl.size() == reference.size());
+        }
+        assert(avl.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+        assert(avl.distinct_size() == std::set<int>(reference.begin(), reference.end()).size());
+        if (!reference.empty())
+        {
+            assert(avl.min() == *reference.begin() && avl.max() == *reference.rbegin());
+            assert(avl.block_size() <= avl.distinct_size());
+        }
+    }
+    while (!reference.empty())
+    {
+        assert(avl.pop_min() == *reference.begin());
+        reference.erase(reference.begin());
+    }
+    assert(avl.empty() && avl.block_size() == 0);
+}
+
+void test_blocked_multiset()
+{
+    std::cout << "\n=== Starting Blocked MultiSet Tests ===" << std::endl;
+
+    check_blocked_multiset<4>(5);
+    check_blocked_multiset<64>(6);
+
+    // Sequential inserts fill blocks; far fewer nodes than keys
+    AVLTree::BlockedMultiSet<int, 64> blocked;
+    for (int i = 0; i < 100000; ++i)
+        blocked.insert(i);
+    assert(blocked.distinct_size() == 100000);
+    assert(blocked.block_size() * 20 < blocked.distinct_size());
+    std::vector<int> keys = blocked.to_vector();
+    AVLTree::MultiSet<int> plain(keys.begin(), keys.end());
+    assert(blocked.memory_usage().total() * 3 < plain.memory_usage().total());
+    for (int i = 0; i < 100000; i += 2)
+        blocked.remove(i);
+    assert(blocked.size() == 50000 && blocked.min() == 1 && blocked.count(2) == 0 && blocked.count(3) == 1);
+    assert(blocked.block_size() * 10 < blocked.distinct_size());
+
+    std::cout << "All blocked multiset tests passed successfully!" << std::endl;
+}
+
+void test_merged_view()
+{
+    std::cout << "\n=== Starting Merged View Tests ===" << std::endl;
+
+    const int k = 6;
+    std::vector<AVLTree::MultiSet<int> > buckets(k);
+    std::map<int, size_t> reference;
+    std::mt19937 gen(6006);
+    std::uniform_int_distribution<> dis(0, 1000);
+    // Bucket k - 1 stays empty; bucket 0 carries tombstones
+    buckets[0].set_lazy_deletion(true, 1.0);
+    for (int b = 0; b < k - 1; ++b)
+    {
+        for (int i = 0; i < 2000; ++i)
+        {
+            int val = dis(gen);
+            buckets[b].insert(val);
+            reference[val]++;
+        }
+    }
+    for (int i = 0; i < 1000; ++i)
+    {
+        int val = dis(gen);
+        if (buckets[0].contains(val))
+        {
+            buckets[0].remove(val);
+            if (--reference[val] == 0)
+                reference.erase(val);
+        }
+    }
+    assert(buckets[0].tombstone_size() > 0);
+
+    AVLTree::MergedView<int> view;
+    for (int b = 0; b < k; ++b)
+        view.add(buckets[b]);
+    assert(view.tree_count() == static_cast<size_t>(k));
+
+    size_t total = 0;
+    std::map<int, size_t>::const_iterator expected = reference.begin();
+    for (AVLTree::MergedView<int>::Cursor c = view.begin(); c.valid(); c.next())
+    {
+        assert(expected != reference.end());
+        assert(c.key() == expected->first && c.count() == expected->second);
+        total += c.count();
+        ++expected;
+    }
+    assert(expected == reference.end() && total == view.size());
+
+    // Seeks land on the first key >= target across all trees
+    for (int i = 0; i < 200; ++i)
+    {
+        int target = dis(gen) + (i % 2 ? 0 : 50) - 25;
+        AVLTree::MergedView<int>::Cursor c = view.lower_bound(target);
+        std::map<int, size_t>::const_iterator it = reference.lower_bound(target);
+        if (it == reference.end())
+        {
+            assert(!c.valid());
+            continue;
+        }
+        assert(c.valid() && c.key() == it->first && c.count() == it->second);
+        assert(view.count(target) == (reference.count(target) ? reference[target] : 0));
+
+        // Cursors can re-seek in either direction
+        assert(c.seek(0) && c.key() == reference.begin()->first);
+    }
+
+    // Top-N stops after N keys
+    std::vector<int> top;
+    for (AVLTree::MergedView<int>::Cursor c = view.begin(); c.valid() && top.size() < 10; c.next())
+        top.push_back(c.key());
+    std::vector<int> expected_top;
+    for (expected = reference.begin(); expected_top.size() < 10; ++expected)
+        expected_top.push_back(expected->first);
+    assert(top == expected_top);
+
+    // Modifying a tree under a live cursor stops it rather than reading
+    // the freed nodes its fingers still point at
+    AVLTree::MergedView<int>::Cursor live = view.begin();
+    live.next();
+    assert(live.valid());
+    std::vector<int> moved = buckets[1].to_vector();
+    buckets[1].clear();
+    assert(!live.next() && !live.valid());
+    for (size_t i = 0; i < moved.size(); ++i)
+        buckets[1].insert(moved[i]);
+    assert(live.seek(0) && live.key() == reference.begin()->first);
+
+    AVLTree::MergedView<int> none;
+    assert(!none.begin().valid() && none.empty());
+
+    std::cout << "All merged view tests passed successfully!" << std::endl;
+}
+
+void test_trace()
+{
+    std::cout << "\n=== Starting Trace Tests ===" << std::endl;
+
+    const std::string path = "trace_test.trace";
+    typedef AVLTree::TraceOp Op;
+    {
+        AVLTree::TraceRecorder<int> recorder(path);
+        AVLTree::MultiSet<int> tree;
+        std::vector<int> bulk = {9, 1, 5, 5, 3};
+        tree.insert(bulk.begin(), bulk.end()); // empty tree: bulk path
+        tree.attach_trace(&recorder);
+        tree.insert(bulk.begin(), bulk.end()); // recorded once, not per key
+        tree.insert(7);
+        tree.insert_multiple(4, 3);
+        tree.remove(5);
+        tree.remove_multiple(4, 2);
+        tree.remove_all(1);
+        assert(tree.count(9) == 2 && tree.contains(3));
+        assert(tree.min() == 3 && tree.max() == 9);
+        assert(tree.pop_min() == 3 && tree.pop_max() == 9);
+
+        // Buffered calls record the call, not the flush
+        tree.set_write_buffer(4);
+        for (int i = 0; i < 10; ++i)
+            tree.insert(100 + i);
+        tree.flush();
+        tree.to_vector();
+        tree.clear();
+        tree.attach_trace(nullptr);
+        tree.insert(1);
+        assert(recorder.records() == 23);
+    }
+
+    AVLTree::TraceReader<int> reader(path);
+    const Op expected[] = {Op::BulkInsert, Op::Insert, Op::InsertMultiple, Op::Remove, Op::RemoveMultiple,
+                           Op::RemoveAll, Op::Count, Op::Contains, Op::Min, Op::Max, Op::PopMin, Op::PopMax};
+    const size_t n = sizeof(expected) / sizeof(expected[0]);
+    assert(reader.records.size() == n + 11);
+    for (size_t i = 0; i < n; ++i)
+        assert(reader.records[i].op == expected[i]);
+    assert(reader.records[0].amount == 5 && reader.bulk_keys == std::vector<int>({9, 1, 5, 5, 3}));
+    assert(reader.records[2].key == 4 && reader.records[2].amount == 3);
+    assert(reader.records[4].key == 4 && reader.records[4].amount == 2);
+    for (size_t i = 0; i < 10; ++i)
+        assert(reader.records[n + i].op == Op::Insert && reader.records[n + i].key == static_cast<int>(100 + i));
+    assert(reader.records.back().op == Op::Clear);
+
+    // A record cut short by a crash ends the trace
+    assert(truncate(path.c_str(), 8 + 1 + 8 + 5 * sizeof(int) + 2) == 0);
+    AVLTree::TraceReader<int> truncated(path);
+    assert(truncated.records.size() == 1 && truncated.records[0].op == Op::BulkInsert);
+
+    // An op byte outside Insert..Clear is corruption, not a short trace
+    const long insert_offset = 8 + 1 + 8 + 5 * sizeof(int);
+    std::FILE *file = std::fopen(path.c_str(), "rb+");
+    std::fseek(file, insert_offset, SEEK_SET);
+    std::fputc(0, file);
+    std::fclose(file);
+    bool threw = false;
+    try
+    {
+        AVLTree::TraceReader<int> corrupt(path);
+    }
+    catch (const std::runtime_error &e)
+    {
+        threw = std::string(e.what()).find("offset " + std::to_string(insert_offset)) != std::string::npos;
+    }
+    assert(threw);
+
+    // A corrupt BulkInsert amount reads only as far as the file goes
+    {
+        AVLTree::TraceRecorder<int> recorder(path);
+        AVLTree::MultiSet<int> tree;
+        tree.attach_trace(&recorder);
+        std::vector<int> bulk = {3, 1, 2};
+        tree.insert(bulk.begin(), bulk.end());
+    }
+    file = std::fopen(path.c_str(), "rb+");
+    std::fseek(file, 8 + 1, SEEK_SET);
+    const uint64_t bogus = uint64_t(1) << 60;
+    std::fwrite(&bogus, sizeof(bogus), 1, file);
+    std::fclose(file);
+    AVLTree::TraceReader<int> oversized(path);
+    assert(oversized.records.empty() && oversized.bulk_keys.empty());
+
+    std::remove(path.c_str());
+    threw = false;
+    try
+    {
+        AVLTree::TraceReader<int> missing(path);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    std::cout << "All trace tests passed successfully!" << std::endl;
+}
+
+void test_bounded()
+{
+    std::cout << "\n=== Starting Bounded Tests ===" << std::endl;
+
+    std::mt19937 gen(3939);
+    std::uniform_int_distribution<> dis(0, 5000);
+    std::uniform_int_distribution<> dup(0, 50);
+    for (int side = 0; side < 2; ++side)
+    {
+        AVLTree::Evict evict = side == 0 ? AVLTree::Evict::Max : AVLTree::Evict::Min;
+        const size_t k = 100;
+        std::vector<int> stream;
+        AVLTree::MultiSet<int, AVLTree::SumAugment<int> > tree;
+        tree.set_bound(k, evict);
+        tree.set_lazy_deletion(side == 1);
+        assert(tree.bound() == k);
+        for (int i = 0; i < 20000; ++i)
+        {
+            // Heavy duplication so evictions often just decrement a count
+            int val = i % 3 ? dup(gen) * 100 : dis(gen);
+            switch (i % 7)
+            {
+            case 0:
+                tree.insert_multiple(val, 4);
+                stream.insert(stream.end(), 4, val);
+                break;
+            case 1:
+            {
+                std::vector<int> batch;
+                for (int j = 0; j < 150; ++j)
+                    batch.push_back(dis(gen));
+                tree.insert(batch.begin(), batch.end());
+                stream.insert(stream.end(), batch.begin(), batch.end());
+                break;
+            }
+            default:
+                tree.insert(val);
+                stream.push_back(val);
+            }
+            if (i % 997 == 0)
+            {
+                std::vector<int> expected(stream);
+                std::sort(expected.begin(), expected.end());
+                if (side == 0)
+                    expected.resize(std::min(k, expected.size()));
+                else
+                    expected.erase(expected.begin(), expected.end() - std::min(k, expected.size()));
+                assert(tree.to_vector() == expected);
+                long long sum = 0;
+                for (size_t j = 0; j < expected.size(); ++j)
+                    sum += expected[j];
+                assert(tree.aggregate() == sum);
+                stream.swap(expected);
+            }
+        }
+        assert(tree.size() == k);
+    }
+
+    // Lowering the bound evicts at once; removals make room again
+    AVLTree::MultiSet<int> tree;
+    for (int i = 0; i < 50; ++i)
+        tree.insert(i % 10);
+    tree.set_bound(12);
+    assert(tree.size() == 12 && tree.max() == 2 && tree.count(2) == 2);
+    tree.insert(5);
+    assert(tree.size() == 12 && tree.count(5) == 0);
+    tree.remove(0);
+    tree.insert(5);
+    assert(tree.size() == 12 && tree.count(5) == 1);
+    tree.insert(-1);
+    assert(tree.count(5) == 0 && tree.min() == -1);
+    tree.set_bound(0);
+    tree.insert(100);
+    assert(tree.size() == 13);
+
+    // A full inline pool evicts before inserting, so the new key gets the
+    // evicted node's slot
+    AVLTree::StaticMultiSet<int, 4> fixed;
+    fixed.set_bound(4, AVLTree::Evict::Min);
+    for (int i = 1; i <= 4; ++i)
+        fixed.insert(i);
+    fixed.insert(5);
+    assert(fixed.to_vector() == std::vector<int>({2, 3, 4, 5}));
+    fixed.insert_multiple(9, 2);
+    assert(fixed.to_vector() == std::vector<int>({4, 5, 9, 9}));
+    fixed.set_bound(4, AVLTree::Evict::Max);
+    fixed.set_lazy_deletion(true, 1.0);
+    fixed.remove(5);
+    fixed.insert(1);
+    fixed.insert(2);
+    assert(fixed.to_vector() == std::vector<int>({1, 2, 4, 9}));
+    // The kept values still need more distinct keys than the pool holds
+    fixed.set_bound(8, AVLTree::Evict::Max);
+    bool threw = false;
+    try
+    {
+        fixed.insert(3);
+    }
+    catch (const std::length_error &)
+    {
+        threw = true;
+    }
+    assert(threw && fixed.to_vector() == std::vector<int>({1, 2, 4, 9}));
+
+    // Evictions are journaled, so recovery without a bound agrees
+    const std::string path = "bounded_test.log";
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+    std::vector<int> kept;
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> bounded;
+        bounded.attach_journal(&journal);
+        bounded.set_bound(20, AVLTree::Evict::Min);
+        bounded.set_write_buffer(8);
+        for (int i = 0; i < 500; ++i)
+        {
+            bounded.insert(dis(gen) % 300);
+            if (i % 50 == 0)
+                bounded.remove(bounded.max());
+        }
+        kept = bounded.to_vector();
+        assert(kept.size() == 20);
+    }
+    {
+        AVLTree::Journal<int> journal(path);
+        AVLTree::MultiSet<int> recovered;
+        journal.recover(recovered);
+        assert(recovered.to_vector() == kept);
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+
+    std::cout << "All bounded tests passed successfully!" << std::endl;
+}
+
+// Wraps a balancing policy and checks its rank rule on every subtree it
+// returns, two levels down (rotations move grandchildren).
+template <typename Base>
+struct CheckedBalance
+{
+    template <typename Node>
+    static int rank(const Node *node) { return node ? node->height : 0; }
+
+    template <typename Node>
+    static void check(const Node *node, int depth)
+    {
+        if (node == nullptr || depth == 0)
+            return;
+        int left = rank(node) - rank(node->left), right = rank(node) - rank(node->right);
+        if (std::is_same<Base, AVLTree::AVLBalance>::value)
+            assert(node->height == 1 + std::max(rank(node->left), rank(node->right)) && std::abs(left - right) <= 1);
+        else if (std::is_same<Base, AVLTree::WAVLBalance>::value)
+            assert(left >= 1 && left <= 2 && right >= 1 && right <= 2 && (node->left || node->right || node->height == 1));
+        else
+            assert(left >= 1 && right >= 1);
+        check(node->left, depth - 1);
+        check(node->right, depth - 1);
+    }
+
+    template <typename Node>
+    static Node *rebalance(Node *node)
+    {
+        Node *root = Base::rebalance(node);
+        check(root, 3);
+        return root;
+    }
+};
+
+template <typename Balance>
+void check_balance_policy(unsigned seed)
+{
+    typedef AVLTree::MultiSet<int, AVLTree::SumAugment<int>, AVLTree::HeapStorage, CheckedBalance<Balance> > Tree;
+    Tree tree;
+    std::multiset<int> reference;
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<> dis(0, 3000);
+    for (int round = 0; round < 3; ++round)
+    {
+        // Insert-heavy, then delete-heavy, then mixed with hinted inserts
+        for (int i = 0; i < 6000; ++i)
+        {
+            int val = dis(gen);
+            int op = round == 0 ? i % 5 : round == 1 ? (i % 5 == 0 ? 0 : 3) : i % 4;
+            if (op < 2)
+            {
+                tree.insert(val);
+                reference.insert(val);
+            }
+            else if (op == 2)
+            {
+                typename Tree::Finger hint = tree.finger(val);
+                tree.insert(hint, val + 1);
+                reference.insert(val + 1);
+            }
+            else if (!reference.empty())
+            {
+                std::multiset<int>::iterator it = reference.lower_bound(val);
+                int victim = it == reference.end() ? *reference.begin() : *it;
+                tree.remove_all(victim);
+                reference.erase(victim);
+            }
+        }
+        assert(tree.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+        long long sum = 0;
+        for (std::multiset<int>::const_iterator it = reference.begin(); it != reference.end(); ++it)
+            sum += *it;
+        assert(tree.aggregate() == sum);
+        if (!reference.empty())
+            assert(tree.min() == *reference.begin() && tree.max() == *reference.rbegin());
+    }
+
+    // Bulk builds (heavy duplicates) and compaction hand over valid ranks
+    std::vector<int> bulk(20000, 7);
+    for (int i = 0; i < 3000; ++i)
+        bulk.push_back(dis(gen));
+    tree.insert(bulk.begin(), bulk.end());
+    reference.insert(bulk.begin(), bulk.end());
+    tree.compact();
+    for (int i = 0; i < 4000; ++i)
+    {
+        int val = dis(gen);
+        tree.insert(val);
+        reference.insert(val);
+        val = dis(gen);
+        tree.remove(val);
+        if (reference.count(val))
+            reference.erase(reference.find(val));
+        val = dis(gen);
+        tree.remove_all(val);
+        reference.erase(val);
+    }
+    assert(tree.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+    while (!tree.empty())
+    {
+        assert(tree.pop_min() == *reference.begin());
+        reference.erase(reference.begin());
+    }
+}
+
+void test_balance_policies()
+{
+    std::cout << "\n=== Starting Balance Policy Tests ===" << std::endl;
+
+    check_balance_policy<AVLTree::AVLBalance>(4040);
+    check_balance_policy<AVLTree::WAVLBalance>(4041);
+    check_balance_policy<AVLTree::RelaxedBalance>(4042);
+
+    std::cout << "All balance policy tests passed successfully!" << std::endl;
+}
+
+void test_hash_index()
+{
+    std::cout << "\n=== Starting Hash Index Tests ===" << std::endl;
+
+    // The table itself: churn through tombstones, rehashes and overwrites
+    {
+        AVLTree::detail::SwissIndex<int, long> index;
+        std::map<int, long> reference;
+        std::mt19937 gen(4141);
+        std::uniform_int_distribution<> dis(0, 4000);
+        for (int i = 0; i < 200000; ++i)
+        {
+            int key = dis(gen);
+            if (i % 3 == 0)
+            {
+                bool erased = index.erase(key, reference.count(key) ? reference[key] : -1);
+                assert(erased == (reference.erase(key) > 0));
+            }
+            else
+            {
+                index.insert(key, i);
+                reference[key] = i;
+            }
+            if (i % 1000 == 0)
+            {
+                assert(index.size() == reference.size());
+                for (int k = 0; k <= 4000; k += 7)
+                    assert(index.find(k) == (reference.count(k) ? reference[k] : 0));
+            }
+        }
+        assert(!index.erase(reference.begin()->first, -5));
+        index.clear();
+        assert(index.size() == 0 && index.find(reference.begin()->first) == 0 && index.memory_bytes() == 0);
+    }
+
+    // Kept in sync through every path that creates, destroys or re-keys nodes
+    for (int lazy = 0; lazy < 2; ++lazy)
+    {
+        AVLTree::MultiSet<int> tree;
+        std::multiset<int> reference;
+        std::mt19937 gen(4242 + lazy);
+        std::uniform_int_distribution<> dis(0, 2000);
+        tree.set_lazy_deletion(lazy == 1);
+        for (int i = 0; i < 500; ++i)
+        {
+            int val = dis(gen);
+            tree.insert(val);
+            reference.insert(val);
+        }
+        tree.set_hash_index(true);
+        for (int i = 0; i < 40000; ++i)
+        {
+            int val = dis(gen);
+            switch (i % 9)
+            {
+            case 0:
+            case 1:
+                tree.insert(val);
+                reference.insert(val);
+                break;
+            case 2:
+                tree.insert_multiple(val, 3);
+                reference.insert(val);
+                reference.insert(val);
+                reference.insert(val);
+                break;
+            case 3:
+                tree.remove(val);
+                if (reference.count(val))
+                    reference.erase(reference.find(val));
+                break;
+            case 4:
+                tree.remove_multiple(val, 2);
+                for (int k = 0; k < 2 && reference.count(val); ++k)
+                    reference.erase(reference.find(val));
+                break;
+            case 5:
+                tree.remove_all(val);
+                reference.erase(val);
+                break;
+            case 6:
+                if (!reference.empty())
+                {
+                    assert(tree.pop_min() == *reference.begin());
+                    reference.erase(reference.begin());
+                }
+                break;
+            case 7:
+            {
+                AVLTree::MultiSet<int>::Finger hint = tree.finger(val);
+                tree.insert(hint, val);
+                reference.insert(val);
+                break;
+            }
+            default:
+                assert(tree.count(val) == reference.count(val));
+                assert(tree.contains(val) == (reference.count(val) > 0));
+            }
+            if (i % 10000 == 9999)
+            {
+                // Bulk rebuild, then compaction, then clear
+                std::vector<int> bulk;
+                for (int k = 0; k < 3000; ++k)
+                    bulk.push_back(dis(gen));
+                tree.insert(bulk.begin(), bulk.end());
+                reference.insert(bulk.begin(), bulk.end());
+                if (i == 19999)
+                    tree.compact();
+                if (i == 29999)
+                {
+                    tree.clear();
+                    reference.clear();
+                }
+            }
+        }
+        for (int val = -1; val <= 2001; ++val)
+            assert(tree.count(val) == reference.count(val) && tree.contains(val) == (reference.count(val) > 0));
+        assert(tree.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+        assert(tree.memory_usage().bookkeeping_bytes >= tree.distinct_size() * (sizeof(int) + sizeof(void *)));
+
+        tree.set_hash_index(false);
+        for (int val = 0; val <= 2000; val += 3)
+            assert(tree.count(val) == reference.count(val));
+    }
+
+    std::cout << "All hash index tests passed successfully!" << std::endl;
+}
+
+void test_interval_multiset()
+{
+    std::cout << "\n=== Starting Interval MultiSet Tests ===" << std::endl;
+    typedef AVLTree::Interval<int> Interval;
+
+    std::mt19937 gen(4343);
+    std::uniform_int_distribution<> start_dis(0, 10000);
+    std::uniform_int_distribution<> length_dis(0, 300);
+    auto random_interval = [&]() {
+        int start = start_dis(gen);
+        return Interval(start, start + length_dis(gen));
+    };
+
+    // Brute force over the reference multiset, in the tree's order
+    auto expected_overlap = [](const std::multiset<Interval> &reference, int lo, int hi) {
+        std::vector<std::pair<Interval, size_t> > result;
+        for (auto it = reference.begin(); it != reference.end(); it = reference.upper_bound(*it))
+        {
+            if (it->start <= hi && lo <= it->end)
+                result.push_back(std::make_pair(*it, reference.count(*it)));
+        }
+        return result;
+    };
+    auto check_queries = [&](const AVLTree::IntervalMultiSet<int> &tree, const std::multiset<Interval> &reference) {
+        for (int q = 0; q < 50; ++q)
+        {
+            int lo = start_dis(gen);
+            int hi = lo + length_dis(gen) * (q % 3);
+            std::vector<std::pair<Interval, size_t> > found;
+            tree.overlap(lo, hi, [&](const Interval &interval, size_t count) {
+                found.push_back(std::make_pair(interval, count));
+            });
+            assert(found == expected_overlap(reference, lo, hi));
+
+            found.clear();
+            tree.stab(lo, [&](const Interval &interval, size_t count) {
+                found.push_back(std::make_pair(interval, count));
+            });
+            assert(found == expected_overlap(reference, lo, lo));
+        }
+    };
+
+    // Single inserts and removals, including two-child removals that move
+    // a successor and its end into an inner node
+    {
+        AVLTree::IntervalMultiSet<int> tree;
+        std::multiset<Interval> reference;
+        std::vector<Interval> inserted;
+        for (int i = 0; i < 20000; ++i)
+        {
+            if (i % 3 == 2 && !inserted.empty())
+            {
+                Interval victim = inserted[gen() % inserted.size()];
+                if (i % 2)
+                {
+                    tree.remove(victim);
+                    if (reference.count(victim))
+                        reference.erase(reference.find(victim));
+                }
+                else
+                {
+                    tree.remove_all(victim);
+                    reference.erase(victim);
+                }
+            }
+            else
+            {
+                Interval interval = random_interval();
+                size_t amount = 1 + i % 2;
+                tree.insert_multiple(interval, amount);
+                for (size_t k = 0; k < amount; ++k)
+                    reference.insert(interval);
+                inserted.push_back(interval);
+            }
+            if (i % 2000 == 0)
+                check_queries(tree, reference);
+        }
+        check_queries(tree, reference);
+        assert(tree.size() == reference.size());
+        assert(tree.to_vector() == std::vector<Interval>(reference.begin(), reference.end()));
+        for (size_t i = 0; i < 200; ++i)
+            assert(tree.count(inserted[i]) == reference.count(inserted[i]));
+
+        // Bulk insert into a populated tree, unsorted
+        std::vector<Interval> bulk;
+        for (int i = 0; i < 30000; ++i)
+            bulk.push_back(random_interval());
+        tree.insert(bulk.begin(), bulk.end());
+        reference.insert(bulk.begin(), bulk.end());
+        check_queries(tree, reference);
+        assert(tree.size() == reference.size());
+    }
+
+    // Bulk build from sorted intervals, then updates on the built tree
+    {
+        std::vector<Interval> sorted;
+        for (int i = 0; i < 5000; ++i)
+            sorted.push_back(random_interval());
+        sorted.push_back(Interval(-50, 20000)); // spans everything
+        std::sort(sorted.begin(), sorted.end());
+        AVLTree::IntervalMultiSet<int> tree(sorted.begin(), sorted.end());
+        std::multiset<Interval> reference(sorted.begin(), sorted.end());
+        check_queries(tree, reference);
+        size_t spanning = 0;
+        tree.stab(-10, [&](const Interval &, size_t count) { spanning += count; });
+        assert(spanning == 1);
+        tree.remove(Interval(-50, 20000));
+        reference.erase(Interval(-50, 20000));
+        for (int i = 0; i < 500; ++i)
+        {
+            tree.insert(sorted[i].start, sorted[i].end);
+            reference.insert(sorted[i]);
+        }
+        check_queries(tree, reference);
+        assert(tree.size() == reference.size());
+        assert(tree.distinct_size() == std::set<Interval>(reference.begin(), reference.end()).size());
+        tree.clear();
+        assert(tree.empty());
+        size_t calls = 0;
+        tree.overlap(0, 100, [&](const Interval &, size_t) { calls++; });
+        assert(calls == 0);
+    }
+
+    bool caught = false;
+    try
+    {
+        AVLTree::IntervalMultiSet<int> tree;
+        tree.insert(5, 4);
+    }
+    catch (const std::invalid_argument &)
+    {
+        caught = true;
+    }
+    assert(caught);
+
+    std::cout << "All interval multiset tests passed successfully!" << std::endl;
+}
+
+void test_shared_multiset()
+{
+    std::cout << "\n=== Starting Shared MultiSet Tests ===" << std::endl;
+    const std::string path = "/tmp/avl_shared_test_" + std::to_string(getpid());
+
+    // Single process: writer and a read-only mapping against a reference
+    {
+        AVLTree::SharedMultiSet<int> writer(path, 4000);
+        AVLTree::SharedMultiSet<int> reader(path);
+        assert(writer.writable() && !reader.writable() && reader.capacity() == 4000);
+        std::multiset<int> reference;
+        std::mt19937 gen(4444);
+        std::uniform_int_distribution<> dis(0, 3000);
+        for (int i = 0; i < 30000; ++i)
+        {
+            int val = dis(gen);
+            switch (i % 5)
+            {
+            case 0:
+            case 1:
+                writer.insert(val);
+                reference.insert(val);
+                break;
+            case 2:
+                writer.insert_multiple(val, 2);
+                reference.insert(val);
+                reference.insert(val);
+                break;
+            case 3:
+                writer.remove(val);
+                if (reference.count(val))
+                    reference.erase(reference.find(val));
+                break;
+            default:
+                writer.remove_all(val);
+                reference.erase(val);
+            }
+            if (i % 3000 == 0)
+            {
+                for (int k = 0; k <= 3000; k += 11)
+                    assert(reader.count(k) == reference.count(k));
+            }
+        }
+        assert(reader.size() == reference.size());
+        assert(reader.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+        assert(reader.min() == *reference.begin() && reader.max() == *reference.rbegin());
+
+        // Bulk rebuild, then updates that reuse the rebuilt slots
+        std::vector<int> bulk;
+        for (int i = 0; i < 20000; ++i)
+            bulk.push_back(dis(gen));
+        writer.insert(bulk.begin(), bulk.end());
+        reference.insert(bulk.begin(), bulk.end());
+        for (int i = 0; i < 500; ++i)
+        {
+            writer.remove_all(bulk[i]);
+            reference.erase(bulk[i]);
+            writer.insert(-i);
+            reference.insert(-i);
+        }
+        assert(reader.to_vector() == std::vector<int>(reference.begin(), reference.end()));
+        assert(reader.memory_usage().node_bytes > 0);
+
+        // Read-only mappings cannot write
+        bool caught = false;
+        try
+        {
+            reader.insert(1);
+        }
+        catch (const std::logic_error &)
+        {
+            caught = true;
+        }
+        assert(caught);
+
+        // A full segment rejects new keys and stays intact
+        writer.clear();
+        for (int i = 0; i < 4000; ++i)
+            writer.insert(i);
+        caught = false;
+        try
+        {
+            writer.insert(5000);
+        }
+        catch (const std::length_error &)
+        {
+            caught = true;
+        }
+        assert(caught && reader.size() == 4000 && reader.count(3999) == 1 && !reader.contains(5000));
+        writer.insert(3999);
+        assert(reader.count(3999) == 2);
+
+        // A small range insert is checked up front, not applied in part
+        std::vector<int> range = {3999, 5000, 1};
+        caught = false;
+        try
+        {
+            writer.insert(range.begin(), range.end());
+        }
+        catch (const std::length_error &)
+        {
+            caught = true;
+        }
+        assert(caught && reader.count(3999) == 2 && reader.count(1) == 1 && reader.size() == 4001);
+
+        // Only one writer at a time
+        caught = false;
+        try
+        {
+            AVLTree::SharedMultiSet<int> second(path, AVLTree::SharedAccess::ReadWrite);
+        }
+        catch (const std::runtime_error &)
+        {
+            caught = true;
+        }
+        assert(caught);
+    }
+
+    // The segment outlives its writer; a new writer picks it up
+    {
+        AVLTree::SharedMultiSet<int> writer(path, AVLTree::SharedAccess::ReadWrite);
+        assert(writer.size() == 4001);
+        writer.remove_all(3999);
+        AVLTree::SharedMultiSet<int> reader(path);
+        assert(reader.size() == 3999 && !reader.contains(3999));
+    }
+
+    // An odd sequence is waited out while the writer lock is held; once
+    // it is free too, the writer died mid-update and readers give up after
+    // the stall timeout instead of spinning forever. A pointer that fails
+    // validation with no write in progress is corruption.
+    {
+        AVLTree::SharedMultiSet<int> reader(path);
+        reader.set_stall_timeout(std::chrono::milliseconds(20));
+        const off_t sequence_offset = 8 + 4 + 4 + 8, root_offset = sequence_offset + 8;
+        int raw = open(path.c_str(), O_RDWR);
+        uint64_t sequence = 0;
+        ssize_t read_bytes = pread(raw, &sequence, sizeof(sequence), sequence_offset);
+        assert(read_bytes == sizeof(sequence) && sequence == 2 * reader.version());
+        auto store = [raw](off_t offset, int64_t value) {
+            ssize_t written = pwrite(raw, &value, sizeof(value), offset);
+            assert(written == sizeof(value));
+        };
+
+        {
+            AVLTree::SharedMultiSet<int> slow_writer(path, AVLTree::SharedAccess::ReadWrite);
+            store(sequence_offset, sequence + 1);
+            std::thread finish([&]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                store(sequence_offset, sequence);
+            });
+            assert(reader.count(1) == 1);
+            finish.join();
+        }
+
+        store(sequence_offset, sequence + 1);
+        bool stalled = false;
+        try
+        {
+            reader.count(1);
+        }
+        catch (const std::runtime_error &e)
+        {
+            stalled = std::string(e.what()).find("mid-update") != std::string::npos;
+        }
+        assert(stalled);
+
+        store(sequence_offset, sequence);
+        store(root_offset, 1);
+        bool corrupt = false;
+        try
+        {
+            reader.count(1);
+        }
+        catch (const std::runtime_error &e)
+        {
+            corrupt = std::string(e.what()).find("corrupt") != std::string::npos;
+        }
+        assert(corrupt);
+        close(raw);
+    }
+
+    bool caught = false;
+    try
+    {
+        AVLTree::SharedMultiSet<long long> wrong_key(path);
+    }
+    catch (const std::runtime_error &)
+    {
+        caught = true;
+    }
+    assert(caught);
+
+    // Concurrent reader process. The writer only ever holds key k with
+    // count k % 7 + 1, so a torn read would show any other count.
+    {
+        AVLTree::SharedMultiSet<int> writer(path, 2000);
+        pid_t child = fork();
+        assert(child >= 0);
+        if (child == 0)
+        {
+            bool consistent = true;
+            try
+            {
+                AVLTree::SharedMultiSet<int> reader(path);
+                std::mt19937 gen(4545);
+                uint64_t last = reader.version();
+                for (int i = 0; i < 20000 && consistent; ++i)
+                {
+                    int key = gen() % 1000;
+                    size_t count = reader.count(key);
+                    consistent = count == 0 || count == static_cast<size_t>(key % 7 + 1);
+                    if (i % 500 == 0)
+                    {
+                        std::vector<int> all = reader.to_vector();
+                        for (size_t j = 0; j < all.size() && consistent;)
+                        {
+                            size_t run = std::upper_bound(all.begin(), all.end(), all[j]) - all.begin() - j;
+                            consistent = run == static_cast<size_t>(all[j] % 7 + 1);
+                            j += run;
+                        }
+                        consistent = consistent && reader.version() >= last;
+                        last = reader.version();
+                    }
+                }
+            }
+            catch (...)
+            {
+                consistent = false;
+            }
+            _exit(consistent ? 0 : 1);
+        }
+        std::mt19937 gen(4646);
+        for (int i = 0; i < 200000; ++i)
+        {
+            int key = gen() % 1000;
+            if (writer.contains(key))
+                writer.remove_all(key);
+            else
+                writer.insert_multiple(key, key % 7 + 1);
+            if (i % 50000 == 0)
+            {
+                std::vector<int> bulk;
+                for (int k = 1000; k < 1700; ++k)
+                    bulk.insert(bulk.end(), k % 7 + 1, k);
+                writer.insert(bulk.begin(), bulk.end());
+                for (int k = 1000; k < 1700; ++k)
+                    writer.remove_all(k);
+            }
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    unlink(path.c_str());
+
+    std::cout << "All shared multiset tests passed successfully!" << std::endl;
+}
+
 int main()
 {
     test_avl_tree();
+    test_aggregate();
+    test_map();
+    test_lazy_deletion();
+    test_finger();
+    test_compact();
+    test_sharded();
+    test_journal();
+    test_static_multiset();
+    test_sliding_window_quantile();
+    test_write_buffer();
+    test_blocked_multiset();
+    test_merged_view();
+    test_trace();
+    test_bounded();
+    test_balance_policies();
+    test_hash_index();
+    test_interval_multiset();
+    test_shared_multiset();
     return 0;
 }
\ No newline at end of file
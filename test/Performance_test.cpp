@@ -1,6 +1,13 @@
 #include <set>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <queue>
 #include <random>
+#include <unordered_map>
 #include <chrono>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
 #include "avl_tree.hpp"
@@ -20,6 +27,17 @@ public:
     }
 };
 
+// Results are written here so the optimizer cannot drop timed lookups
+volatile long long sink;
+
+// Value at quantile q (0..1) of the samples; reorders them.
+double percentile(std::vector<double> &samples, double q)
+{
+    size_t index = std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
 std::vector<int> generate_random_data(size_t count, size_t data_size)
 {
     std::random_device rd;
@@ -246,11 +264,1319 @@ void benchmark_operations(size_t data_size)
     print_result("Pop Min/Max (25K ops each)", avl_time, std_time);
 }
 
+void benchmark_map(size_t data_size)
+{
+    std::cout << "\nBenchmarking Map with size: " << data_size << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Operation"
+              << std::setw(15) << "AVLTree (ms)"
+              << std::setw(15) << "std::map (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto keys = generate_random_data(data_size, data_size);
+    const auto test_data = generate_random_data(50000, data_size);
+
+    double avl_time, std_time;
+
+    // Test operator[] updates (insert on first touch)
+    {
+        AVLTree::Map<int, int> avl;
+        Timer t1;
+        for (int key : keys)
+        {
+            avl[key] += 1;
+        }
+        avl_time = t1.elapsed();
+    }
+    {
+        std::map<int, int> m;
+        Timer t2;
+        for (int key : keys)
+        {
+            m[key] += 1;
+        }
+        std_time = t2.elapsed();
+    }
+    print_result("operator[] (N ops)", avl_time, std_time);
+
+    // Test insert_or_assign
+    {
+        AVLTree::Map<int, int> avl;
+        for (int key : keys)
+            avl[key] = key;
+        Timer t1;
+        for (int key : test_data)
+        {
+            avl.insert_or_assign(key, key);
+        }
+        avl_time = t1.elapsed();
+    }
+    {
+        std::map<int, int> m;
+        for (int key : keys)
+            m[key] = key;
+        Timer t2;
+        for (int key : test_data)
+        {
+            auto it = m.lower_bound(key);
+            if (it != m.end() && it->first == key)
+                it->second = key;
+            else
+                m.emplace_hint(it, key, key);
+        }
+        std_time = t2.elapsed();
+    }
+    print_result("insert_or_assign (50K ops)", avl_time, std_time);
+
+    // Test find
+    {
+        AVLTree::Map<int, int> avl;
+        for (int key : keys)
+            avl[key] = key;
+        long long sum = 0;
+        Timer t1;
+        for (int key : test_data)
+        {
+            auto it = avl.find(key);
+            if (it != avl.end())
+                sum += it->second;
+        }
+        avl_time = t1.elapsed();
+        sink = sum;
+    }
+    {
+        std::map<int, int> m;
+        for (int key : keys)
+            m[key] = key;
+        long long sum = 0;
+        Timer t2;
+        for (int key : test_data)
+        {
+            auto it = m.find(key);
+            if (it != m.end())
+                sum += it->second;
+        }
+        std_time = t2.elapsed();
+        sink = sum;
+    }
+    print_result("Find (50K ops)", avl_time, std_time);
+
+    // Test erase
+    {
+        AVLTree::Map<int, int> avl;
+        for (int key : keys)
+            avl[key] = key;
+        Timer t1;
+        for (int key : test_data)
+        {
+            avl.erase(key);
+        }
+        avl_time = t1.elapsed();
+    }
+    {
+        std::map<int, int> m;
+        for (int key : keys)
+            m[key] = key;
+        Timer t2;
+        for (int key : test_data)
+        {
+            m.erase(key);
+        }
+        std_time = t2.elapsed();
+    }
+    print_result("Erase (50K ops)", avl_time, std_time);
+
+    // Test ordered iteration
+    {
+        AVLTree::Map<int, int> avl;
+        for (int key : keys)
+            avl[key] = key;
+        long long sum = 0;
+        Timer t1;
+        for (auto it = avl.begin(); it != avl.end(); ++it)
+        {
+            sum += it->second;
+        }
+        avl_time = t1.elapsed();
+        sink = sum;
+    }
+    {
+        std::map<int, int> m;
+        for (int key : keys)
+            m[key] = key;
+        long long sum = 0;
+        Timer t2;
+        for (auto it = m.begin(); it != m.end(); ++it)
+        {
+            sum += it->second;
+        }
+        std_time = t2.elapsed();
+        sink = sum;
+    }
+    print_result("Iterate (full scan)", avl_time, std_time);
+}
+
+// Sorted data with each element displaced by up to `jitter` positions
+std::vector<int> generate_nearly_sorted_data(size_t count, int jitter)
+{
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(-jitter, jitter);
+
+    std::vector<int> data;
+    data.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        data.push_back(static_cast<int>(i) + dist(gen));
+    }
+    return data;
+}
+
+void benchmark_finger(size_t data_size)
+{
+    std::cout << "\nBenchmarking Finger with size: " << data_size << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Operation"
+              << std::setw(15) << "AVLTree (ms)"
+              << std::setw(15) << "std::multiset (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto sorted_data = generate_nearly_sorted_data(data_size, 0);
+    const auto nearly_sorted_data = generate_nearly_sorted_data(data_size, 16);
+    const std::vector<int> *workloads[] = {&sorted_data, &nearly_sorted_data};
+    const char *names[] = {"sorted", "nearly-sorted"};
+
+    double avl_time, std_time;
+
+    for (int w = 0; w < 2; ++w)
+    {
+        const std::vector<int> &data = *workloads[w];
+
+        // Plain inserts start at the root every time
+        {
+            AVLTree::MultiSet<int> avl;
+            Timer t1;
+            for (int val : data)
+            {
+                avl.insert(val);
+            }
+            avl_time = t1.elapsed();
+        }
+        {
+            std::multiset<int> ms;
+            Timer t2;
+            for (int val : data)
+            {
+                ms.insert(val);
+            }
+            std_time = t2.elapsed();
+        }
+        print_result(std::string("Insert ") + names[w], avl_time, std_time);
+
+        // Hinted inserts continue from the previous position
+        {
+            AVLTree::MultiSet<int> avl;
+            AVLTree::MultiSet<int>::Finger hint = avl.finger();
+            Timer t1;
+            for (int val : data)
+            {
+                avl.insert(hint, val);
+            }
+            avl_time = t1.elapsed();
+        }
+        {
+            std::multiset<int> ms;
+            auto hint = ms.end();
+            Timer t2;
+            for (int val : data)
+            {
+                hint = ms.insert(hint, val);
+            }
+            std_time = t2.elapsed();
+        }
+        print_result(std::string("Insert ") + names[w] + " (hint)", avl_time, std_time);
+
+        // Lookups in the same order
+        {
+            AVLTree::MultiSet<int> avl(data.begin(), data.end());
+            long long found = 0;
+            Timer t1;
+            for (int val : data)
+            {
+                found += avl.contains(val);
+            }
+            avl_time = t1.elapsed();
+            sink = found;
+        }
+        {
+            std::multiset<int> ms(data.begin(), data.end());
+            long long found = 0;
+            Timer t2;
+            for (int val : data)
+            {
+                found += ms.find(val) != ms.end();
+            }
+            std_time = t2.elapsed();
+            sink = found;
+        }
+        print_result(std::string("Search ") + names[w], avl_time, std_time);
+
+        {
+            AVLTree::MultiSet<int> avl(data.begin(), data.end());
+            AVLTree::MultiSet<int>::Finger finger = avl.finger();
+            long long found = 0;
+            Timer t1;
+            for (int val : data)
+            {
+                found += finger.seek(val);
+            }
+            avl_time = t1.elapsed();
+            sink = found;
+        }
+        {
+            std::multiset<int> ms(data.begin(), data.end());
+            auto it = ms.begin();
+            long long found = 0;
+            Timer t2;
+            for (int val : data)
+            {
+                // Gallop forward from the previous hit, like the finger does
+                while (it != ms.end() && *it < val)
+                    ++it;
+                if (it == ms.end() || *it > val)
+                    it = ms.lower_bound(val);
+                found += it != ms.end() && *it == val;
+            }
+            std_time = t2.elapsed();
+            sink = found;
+        }
+        print_result(std::string("Search ") + names[w] + " (finger)", avl_time, std_time);
+    }
+}
+
+void benchmark_compact(size_t data_size, size_t cycles)
+{
+    std::cout << "\nBenchmarking compact() with size: " << data_size
+              << " after " << cycles << " insert/remove cycles" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Lookup (1M ops)"
+              << std::setw(15) << "Time (ms)"
+              << std::setw(15) << "Memory (MB)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto initial_data = generate_random_data(data_size, data_size);
+    const auto churn_data = generate_random_data(cycles, data_size);
+    const auto probes = generate_random_data(1000000, data_size);
+
+    AVLTree::MultiSet<int> avl(initial_data.begin(), initial_data.end());
+    for (size_t i = 0; i < cycles; ++i)
+    {
+        avl.insert(churn_data[i]);
+        avl.remove(initial_data[i % data_size]);
+    }
+
+    auto lookup = [&](const std::string &label) {
+        long long found = 0;
+        Timer t;
+        for (int val : probes)
+        {
+            found += avl.contains(val);
+        }
+        double elapsed = t.elapsed();
+        sink = found;
+        std::cout << std::left << std::setw(30) << label
+                  << std::setw(15) << elapsed
+                  << std::setw(15) << avl.memory_usage().total() / (1024.0 * 1024.0) << std::endl;
+    };
+
+    lookup("After churn");
+    {
+        Timer t;
+        avl.compact(AVLTree::NodeLayout::InOrder);
+        std::cout << std::left << std::setw(30) << "compact(InOrder)" << std::setw(15) << t.elapsed() << std::endl;
+    }
+    lookup("In-order layout");
+    {
+        Timer t;
+        avl.compact(AVLTree::NodeLayout::VanEmdeBoas);
+        std::cout << std::left << std::setw(30) << "compact(VanEmdeBoas)" << std::setw(15) << t.elapsed() << std::endl;
+    }
+    lookup("van Emde Boas layout");
+}
+
+void benchmark_sharded(size_t data_size)
+{
+    std::cout << "\nBenchmarking ShardedMultiSet writer scaling with " << data_size << " inserts" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Writer threads"
+              << std::setw(15) << "Sharded (ms)"
+              << std::setw(15) << "Locked MultiSet (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto data = generate_random_data(data_size, data_size);
+    const unsigned thread_counts[] = {1, 2, 4, 8, 16};
+
+    for (unsigned threads : thread_counts)
+    {
+        double sharded_time, locked_time;
+        size_t chunk = (data.size() + threads - 1) / threads;
+
+        {
+            AVLTree::ShardedMultiSet<int> sharded(16);
+            // Seed the shard boundaries the way a warm set would have them
+            sharded.insert(data.begin(), data.begin() + data.size() / 10);
+            Timer t1;
+            std::vector<std::thread> workers;
+            for (unsigned w = 0; w < threads; ++w)
+            {
+                workers.push_back(std::thread([&, w]() {
+                    size_t end = std::min(data.size(), (w + 1) * chunk);
+                    for (size_t i = w * chunk; i < end; ++i)
+                        sharded.insert(data[i]);
+                }));
+            }
+            for (auto &worker : workers)
+                worker.join();
+            sharded_time = t1.elapsed();
+        }
+        {
+            AVLTree::MultiSet<int> avl(data.begin(), data.begin() + data.size() / 10);
+            std::mutex mutex;
+            Timer t2;
+            std::vector<std::thread> workers;
+            for (unsigned w = 0; w < threads; ++w)
+            {
+                workers.push_back(std::thread([&, w]() {
+                    size_t end = std::min(data.size(), (w + 1) * chunk);
+                    for (size_t i = w * chunk; i < end; ++i)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        avl.insert(data[i]);
+                    }
+                }));
+            }
+            for (auto &worker : workers)
+                worker.join();
+            locked_time = t2.elapsed();
+        }
+        print_result(std::to_string(threads), sharded_time, locked_time);
+    }
+
+    // Bulk insert partitions the batch and loads shards in parallel
+    {
+        double sharded_time, plain_time;
+        {
+            AVLTree::ShardedMultiSet<int> sharded(16);
+            Timer t1;
+            sharded.insert(data.begin(), data.end());
+            sharded_time = t1.elapsed();
+        }
+        {
+            Timer t2;
+            AVLTree::MultiSet<int> avl(data.begin(), data.end());
+            plain_time = t2.elapsed();
+        }
+        print_result("Bulk insert", sharded_time, plain_time);
+    }
+}
+
+void benchmark_journal(size_t data_size)
+{
+    std::cout << "\nBenchmarking journal overhead per mutation with up to " << data_size << " ops" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Commit batch"
+              << std::setw(15) << "Journaled (ms)"
+              << std::setw(15) << "Overhead (ns/op)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const std::string path = "journal_bench.log";
+    const auto data = generate_random_data(data_size, data_size / 4);
+    const size_t batches[] = {1, 8, 64, 512, 4096};
+
+    for (size_t batch : batches)
+    {
+        // Small batches fsync per handful of ops; keep their runs short
+        size_t ops = std::min(data.size(), batch * 2000);
+        double plain_time, journaled_time;
+        {
+            AVLTree::MultiSet<int> avl;
+            Timer t1;
+            for (size_t i = 0; i < ops; ++i)
+            {
+                if (i % 4 == 3)
+                    avl.remove(data[i - 1]);
+                else
+                    avl.insert(data[i]);
+            }
+            plain_time = t1.elapsed();
+        }
+        {
+            std::remove(path.c_str());
+            std::remove((path + ".snapshot").c_str());
+            AVLTree::Journal<int> journal(path, batch, std::chrono::hours(1));
+            AVLTree::MultiSet<int> avl;
+            avl.attach_journal(&journal);
+            Timer t2;
+            for (size_t i = 0; i < ops; ++i)
+            {
+                if (i % 4 == 3)
+                    avl.remove(data[i - 1]);
+                else
+                    avl.insert(data[i]);
+            }
+            journal.sync();
+            journaled_time = t2.elapsed();
+        }
+        print_result(std::to_string(batch), journaled_time, (journaled_time - plain_time) * 1e6 / ops);
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+}
+
+void benchmark_static(size_t data_size)
+{
+    const size_t capacity = 1 << 20;
+    std::cout << "\nBenchmarking single-insert latency, StaticMultiSet vs MultiSet, " << data_size << " inserts" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Percentile"
+              << std::setw(15) << "Static (ns)"
+              << std::setw(15) << "MultiSet (ns)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto data = generate_random_data(std::min(data_size, capacity), data_size);
+    std::vector<double> static_ns(data.size()), heap_ns(data.size());
+
+    // Steady-state churn: half the keys are removed again so both trees
+    // recycle node memory, which is where the heap allocator shows jitter.
+    {
+        typedef AVLTree::StaticMultiSet<int, capacity> Static;
+        std::unique_ptr<Static> avl(new Static());
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            avl->insert(data[i]);
+            static_ns[i] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            if (i % 2)
+                avl->remove(data[i / 2]);
+        }
+        sink += avl->size();
+    }
+    {
+        AVLTree::MultiSet<int> avl;
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            avl.insert(data[i]);
+            heap_ns[i] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            if (i % 2)
+                avl.remove(data[i / 2]);
+        }
+        sink += avl.size();
+    }
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    const char *labels[] = {"p50", "p90", "p99", "p99.9"};
+    for (size_t q = 0; q < 4; ++q)
+        print_result(labels[q], percentile(static_ns, quantiles[q]), percentile(heap_ns, quantiles[q]));
+    print_result("max", *std::max_element(static_ns.begin(), static_ns.end()),
+                 *std::max_element(heap_ns.begin(), heap_ns.end()));
+}
+
+// Sliding-window median with two heaps and lazy deletion: the classic
+// baseline for rolling medians.
+struct TwoHeapMedian
+{
+    std::priority_queue<int> low;
+    std::priority_queue<int, std::vector<int>, std::greater<int> > high;
+    std::unordered_map<int, int> delayed;
+    size_t low_size = 0, high_size = 0;
+
+    template <typename Heap>
+    void prune(Heap &heap)
+    {
+        while (!heap.empty())
+        {
+            auto it = delayed.find(heap.top());
+            if (it == delayed.end())
+                break;
+            if (--it->second == 0)
+                delayed.erase(it);
+            heap.pop();
+        }
+    }
+
+    void balance()
+    {
+        if (low_size > high_size + 1)
+        {
+            high.push(low.top());
+            low.pop();
+            low_size--;
+            high_size++;
+            prune(low);
+        }
+        else if (low_size < high_size)
+        {
+            low.push(high.top());
+            high.pop();
+            high_size--;
+            low_size++;
+            prune(high);
+        }
+    }
+
+    void insert(int x)
+    {
+        if (low.empty() || x <= low.top())
+        {
+            low.push(x);
+            low_size++;
+        }
+        else
+        {
+            high.push(x);
+            high_size++;
+        }
+        balance();
+    }
+
+    void erase(int x)
+    {
+        delayed[x]++;
+        if (x <= low.top())
+        {
+            low_size--;
+            if (x == low.top())
+                prune(low);
+        }
+        else
+        {
+            high_size--;
+            if (x == high.top())
+                prune(high);
+        }
+        balance();
+    }
+
+    int median() const { return low.top(); }
+};
+
+void benchmark_sliding_window(size_t window, size_t ticks)
+{
+    std::cout << "\nBenchmarking rolling median, window " << window << ", " << ticks << " ticks" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Structure"
+              << std::setw(15) << "Time (ms)"
+              << std::setw(15) << "ns/tick" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    // Odd window, so lower and upper median coincide across all three
+    window |= 1;
+    const auto data = generate_random_data(window + ticks, window + ticks);
+    long long checksum[3] = {0, 0, 0};
+    double times[3];
+
+    {
+        AVLTree::SlidingWindowQuantile<int> swq(window);
+        for (size_t i = 0; i < window; ++i)
+            swq.push(data[i]);
+        Timer t;
+        for (size_t i = window; i < data.size(); ++i)
+        {
+            swq.push(data[i]);
+            checksum[0] += swq.quantile();
+        }
+        times[0] = t.elapsed();
+    }
+    {
+        TwoHeapMedian heaps;
+        for (size_t i = 0; i < window; ++i)
+            heaps.insert(data[i]);
+        Timer t;
+        for (size_t i = window; i < data.size(); ++i)
+        {
+            heaps.insert(data[i]);
+            heaps.erase(data[i - window]);
+            checksum[1] += heaps.median();
+        }
+        times[1] = t.elapsed();
+    }
+    {
+        std::multiset<int> values(data.begin(), data.begin() + window);
+        auto mid = std::next(values.begin(), window / 2);
+        Timer t;
+        for (size_t i = window; i < data.size(); ++i)
+        {
+            values.insert(data[i]);
+            if (data[i] < *mid)
+                --mid;
+            if (data[i - window] <= *mid)
+                ++mid;
+            values.erase(values.lower_bound(data[i - window]));
+            checksum[2] += *mid;
+        }
+        times[2] = t.elapsed();
+    }
+
+    if (checksum[0] != checksum[1] || checksum[0] != checksum[2])
+        std::cout << "Median mismatch between implementations!" << std::endl;
+    sink += checksum[0];
+    const char *labels[] = {"SlidingWindowQuantile", "Two heaps", "std::multiset + iterator"};
+    for (int k = 0; k < 3; ++k)
+        print_result(labels[k], times[k], times[k] * 1e6 / ticks);
+}
+
+void benchmark_write_buffer(size_t data_size)
+{
+    std::cout << "\nBenchmarking buffered writes, " << data_size << " inserts into a tree of " << data_size << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Buffer capacity"
+              << std::setw(15) << "Buffered (ms)"
+              << std::setw(15) << "Direct (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto initial = generate_random_data(data_size, data_size);
+    const auto writes = generate_random_data(data_size, data_size);
+
+    double direct_time;
+    {
+        AVLTree::MultiSet<int> avl(initial.begin(), initial.end());
+        Timer t;
+        for (size_t i = 0; i < writes.size(); ++i)
+        {
+            if (i % 4 == 3)
+                avl.remove(writes[i - 1]);
+            else
+                avl.insert(writes[i]);
+        }
+        direct_time = t.elapsed();
+        sink += avl.size();
+    }
+
+    const size_t capacities[] = {64, 256, 1024, 4096};
+    for (size_t capacity : capacities)
+    {
+        AVLTree::MultiSet<int> avl(initial.begin(), initial.end());
+        avl.set_write_buffer(capacity);
+        Timer t;
+        for (size_t i = 0; i < writes.size(); ++i)
+        {
+            if (i % 4 == 3)
+                avl.remove(writes[i - 1]);
+            else
+                avl.insert(writes[i]);
+        }
+        avl.flush();
+        print_result(std::to_string(capacity), t.elapsed(), direct_time);
+        sink += avl.size();
+    }
+}
+
+void benchmark_blocked(size_t data_size)
+{
+    std::cout << "\nBenchmarking BlockedMultiSet<int, 64> vs MultiSet with size: " << data_size << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Operation"
+              << std::setw(15) << "Blocked (ms)"
+              << std::setw(15) << "MultiSet (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto data = generate_random_data(data_size, data_size);
+    const auto probes = generate_random_data(data_size, data_size);
+    AVLTree::BlockedMultiSet<int, 64> blocked;
+    AVLTree::MultiSet<int> avl;
+
+    {
+        Timer t1;
+        for (int val : data)
+            blocked.insert(val);
+        double blocked_time = t1.elapsed();
+        Timer t2;
+        for (int val : data)
+            avl.insert(val);
+        print_result("Random insert", blocked_time, t2.elapsed());
+    }
+    {
+        long long found = 0;
+        Timer t1;
+        for (int val : probes)
+            found += blocked.count(val);
+        double blocked_time = t1.elapsed();
+        Timer t2;
+        for (int val : probes)
+            found += avl.count(val);
+        print_result("Random lookup", blocked_time, t2.elapsed());
+        sink += found;
+    }
+    {
+        Timer t1;
+        sink += blocked.to_vector().size();
+        double blocked_time = t1.elapsed();
+        Timer t2;
+        sink += avl.to_vector().size();
+        print_result("In-order scan", blocked_time, t2.elapsed());
+    }
+    print_result("Memory (MB)", blocked.memory_usage().total() / 1048576.0, avl.memory_usage().total() / 1048576.0);
+    print_result("Nodes", blocked.block_size(), avl.distinct_size());
+    {
+        Timer t1;
+        for (size_t i = 0; i < data.size(); i += 2)
+            blocked.remove(data[i]);
+        double blocked_time = t1.elapsed();
+        Timer t2;
+        for (size_t i = 0; i < data.size(); i += 2)
+            avl.remove(data[i]);
+        print_result("Remove half", blocked_time, t2.elapsed());
+    }
+    {
+        Timer t1;
+        AVLTree::BlockedMultiSet<int, 64> bulk_blocked(data.begin(), data.end());
+        double blocked_time = t1.elapsed();
+        Timer t2;
+        AVLTree::MultiSet<int> bulk_avl(data.begin(), data.end());
+        print_result("Bulk build", blocked_time, t2.elapsed());
+    }
+}
+
+void benchmark_merged_view(size_t buckets, size_t per_bucket)
+{
+    std::cout << "\nBenchmarking MergedView over " << buckets << " trees of " << per_bucket << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Query"
+              << std::setw(15) << "View (ms)"
+              << std::setw(15) << "Materialize (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const size_t universe = buckets * per_bucket;
+    std::vector<AVLTree::MultiSet<int> > trees(buckets);
+    AVLTree::MergedView<int> view;
+    for (size_t b = 0; b < buckets; ++b)
+    {
+        const auto data = generate_random_data(per_bucket, universe / 2);
+        trees[b].insert(data.begin(), data.end());
+        view.add(trees[b]);
+    }
+    // Baseline: materialize every tree, then sort the concatenation
+    auto materialize = [&trees]() {
+        std::vector<int> all;
+        for (const auto &tree : trees)
+        {
+            std::vector<int> part = tree.to_vector();
+            all.insert(all.end(), part.begin(), part.end());
+        }
+        std::sort(all.begin(), all.end());
+        return all;
+    };
+
+    {
+        long long total = 0;
+        Timer t1;
+        for (auto c = view.begin(); c.valid(); c.next())
+            total += c.count();
+        double view_time = t1.elapsed();
+        Timer t2;
+        total += materialize().size();
+        print_result("Full ordered scan", view_time, t2.elapsed());
+        sink += total;
+    }
+
+    const size_t queries = 100;
+    const auto starts = generate_random_data(queries, universe / 2);
+    {
+        long long total = 0;
+        Timer t1;
+        for (size_t q = 0; q < queries; ++q)
+        {
+            size_t n = 0;
+            for (auto c = view.begin(); c.valid() && n < 100; c.next(), ++n)
+                total += c.key();
+        }
+        double view_time = t1.elapsed();
+        Timer t2;
+        for (size_t q = 0; q < queries; ++q)
+        {
+            std::vector<int> all = materialize();
+            for (size_t n = 0; n < 100 && n < all.size(); ++n)
+                total += all[n];
+        }
+        print_result("Top-100 x" + std::to_string(queries), view_time, t2.elapsed());
+        sink += total;
+    }
+    {
+        long long total = 0;
+        Timer t1;
+        for (size_t q = 0; q < queries; ++q)
+        {
+            for (auto c = view.lower_bound(starts[q]); c.valid() && c.key() < starts[q] + 1000; c.next())
+                total += c.count();
+        }
+        double view_time = t1.elapsed();
+        Timer t2;
+        for (size_t q = 0; q < queries; ++q)
+        {
+            std::vector<int> all = materialize();
+            total += std::lower_bound(all.begin(), all.end(), starts[q] + 1000) -
+                     std::lower_bound(all.begin(), all.end(), starts[q]);
+        }
+        print_result("Range of 1000 x" + std::to_string(queries), view_time, t2.elapsed());
+        sink += total;
+    }
+}
+
+// K smallest of an n-value stream. Values come from a xorshift generator
+// so the stream never has to be materialized.
+void benchmark_topk(size_t n, size_t k)
+{
+    std::cout << "\nBenchmarking top-" << k << " of " << n << " values" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Method"
+              << std::setw(15) << "Time (ms)"
+              << std::setw(15) << "ns/value" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    struct XorShift
+    {
+        unsigned long long state;
+        int operator()()
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return static_cast<int>(state >> 33);
+        }
+    };
+    const unsigned long long seed = 88172645463325252ULL;
+    auto report = [](const std::string &label, double ms, size_t values) {
+        print_result(label, ms, ms * 1e6 / values);
+    };
+
+    long long heap_sum = 0;
+    {
+        XorShift next = {seed};
+        Timer t;
+        std::priority_queue<int> heap;
+        for (size_t i = 0; i < n; ++i)
+        {
+            int value = next();
+            if (heap.size() < k)
+                heap.push(value);
+            else if (value < heap.top())
+            {
+                heap.pop();
+                heap.push(value);
+            }
+        }
+        for (; !heap.empty(); heap.pop())
+            heap_sum += heap.top();
+        report("std::priority_queue", t.elapsed(), n);
+    }
+    {
+        XorShift next = {seed};
+        Timer t;
+        AVLTree::MultiSet<int> tree;
+        tree.set_bound(k);
+        for (size_t i = 0; i < n; ++i)
+            tree.insert(next());
+        std::vector<int> kept = tree.to_vector();
+        report("Bounded insert", t.elapsed(), n);
+        long long sum = 0;
+        for (size_t i = 0; i < kept.size(); ++i)
+            sum += kept[i];
+        if (sum != heap_sum)
+            std::cout << "Mismatch: bounded insert" << std::endl;
+    }
+    {
+        XorShift next = {seed};
+        Timer t;
+        AVLTree::MultiSet<int> tree;
+        tree.set_bound(k);
+        std::vector<int> batch(4096);
+        for (size_t i = 0; i < n; i += batch.size())
+        {
+            batch.resize(std::min(batch.size(), n - i));
+            for (size_t j = 0; j < batch.size(); ++j)
+                batch[j] = next();
+            tree.insert(batch.begin(), batch.end());
+        }
+        std::vector<int> kept = tree.to_vector();
+        report("Bounded bulk (4096/batch)", t.elapsed(), n);
+        long long sum = 0;
+        for (size_t i = 0; i < kept.size(); ++i)
+            sum += kept[i];
+        if (sum != heap_sum)
+            std::cout << "Mismatch: bounded bulk" << std::endl;
+    }
+    {
+        // The unbounded idiom is far slower; time a tenth of the stream
+        XorShift next = {seed};
+        size_t values = n / 10;
+        Timer t;
+        AVLTree::MultiSet<int> tree;
+        for (size_t i = 0; i < values; ++i)
+        {
+            tree.insert(next());
+            if (tree.size() > k)
+                tree.pop_max();
+        }
+        report("insert + pop_max (n/10)", t.elapsed(), values);
+        sink += tree.size();
+    }
+    sink += heap_sum;
+}
+
+// Counts restructurings (rebalance calls that rotated) under a policy.
+template <typename Base>
+struct CountingBalance
+{
+    static size_t rotations;
+
+    template <typename Node>
+    static Node *rebalance(Node *node)
+    {
+        Node *root = Base::rebalance(node);
+        rotations += root != node;
+        return root;
+    }
+};
+
+template <typename Base>
+size_t CountingBalance<Base>::rotations = 0;
+
+template <typename Base>
+void benchmark_balance_policy(const std::string &name, const std::vector<int> &keys, const std::vector<int> &probes)
+{
+    typedef CountingBalance<Base> Counting;
+    AVLTree::MultiSet<int, AVLTree::NoAugment, AVLTree::HeapStorage, Counting> tree;
+    size_t n = keys.size();
+
+    // Insert-heavy: n distinct-ish random keys into an empty tree
+    Counting::rotations = 0;
+    Timer t1;
+    for (size_t i = 0; i < n; ++i)
+        tree.insert(keys[i]);
+    print_result(name + " insert-heavy", t1.elapsed(), Counting::rotations);
+
+    // Mixed: alternate insert and remove at steady size
+    Counting::rotations = 0;
+    Timer t2;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i % 2)
+            tree.remove(keys[i]);
+        else
+            tree.insert(probes[i]);
+    }
+    print_result(name + " mixed", t2.elapsed(), Counting::rotations);
+
+    // Delete-heavy: four removals per insertion until mostly drained
+    Counting::rotations = 0;
+    Timer t3;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i % 5 == 0)
+            tree.insert(probes[i]);
+        else
+            tree.remove(keys[(i * 7) % n]);
+    }
+    print_result(name + " delete-heavy", t3.elapsed(), Counting::rotations);
+
+    // Lookups on what is left show the cost of any extra height
+    long long found = 0;
+    Timer t4;
+    for (size_t i = 0; i < probes.size(); ++i)
+        found += tree.contains(probes[i]);
+    print_result(name + " lookups after", t4.elapsed(), 0);
+    sink += found + tree.size();
+}
+
+void benchmark_balance(size_t n)
+{
+    std::cout << "\nBenchmarking balancing policies with " << n << " keys" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Policy / workload"
+              << std::setw(15) << "Time (ms)"
+              << std::setw(15) << "Rotations" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto keys = generate_random_data(n, n * 4);
+    const auto probes = generate_random_data(n, n * 4);
+    benchmark_balance_policy<AVLTree::AVLBalance>("AVL", keys, probes);
+    benchmark_balance_policy<AVLTree::WAVLBalance>("WAVL", keys, probes);
+    benchmark_balance_policy<AVLTree::RelaxedBalance>("Relaxed", keys, probes);
+}
+
+void benchmark_hash_index(size_t data_size)
+{
+    std::cout << "\nBenchmarking hash side index with " << data_size << " keys" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Operation"
+              << std::setw(15) << "Indexed (ms)"
+              << std::setw(15) << "Tree (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const auto keys = generate_random_data(data_size, data_size);
+    const auto probes = generate_random_data(data_size, data_size);
+
+    AVLTree::MultiSet<int> indexed(keys.begin(), keys.end());
+    AVLTree::MultiSet<int> plain(keys.begin(), keys.end());
+    indexed.set_hash_index(true);
+
+    double times[2];
+    AVLTree::MultiSet<int> *trees[2] = {&indexed, &plain};
+
+    for (int i = 0; i < 2; ++i)
+    {
+        Timer t;
+        for (int probe : probes)
+            sink += trees[i]->contains(probe);
+        times[i] = t.elapsed();
+    }
+    print_result("Contains", times[0], times[1]);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        Timer t;
+        for (int probe : probes)
+            sink += trees[i]->count(probe);
+        times[i] = t.elapsed();
+    }
+    print_result("Count", times[0], times[1]);
+
+    // Duplicates of present keys only bump a count
+    for (int i = 0; i < 2; ++i)
+    {
+        Timer t;
+        for (int key : keys)
+            trees[i]->insert(key);
+        times[i] = t.elapsed();
+    }
+    print_result("Insert duplicate", times[0], times[1]);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        Timer t;
+        for (size_t j = 0; j < probes.size(); ++j)
+        {
+            if (j % 2 == 0)
+                trees[i]->insert(probes[j]);
+            else
+                trees[i]->remove(probes[j - 1]);
+        }
+        times[i] = t.elapsed();
+    }
+    print_result("Insert/remove mixed", times[0], times[1]);
+
+    print_result("Memory (MB)", indexed.memory_usage().total() / 1048576.0, plain.memory_usage().total() / 1048576.0);
+}
+
+void benchmark_interval(size_t data_size, size_t queries, size_t long_every)
+{
+    std::cout << "\nBenchmarking interval queries with " << data_size << " intervals";
+    if (long_every)
+        std::cout << ", every " << long_every << "th one 100x longer";
+    std::cout << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Operation"
+              << std::setw(15) << "Interval (ms)"
+              << std::setw(15) << "Scan (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    typedef AVLTree::Interval<int> Interval;
+    const int max_length = long_every ? 100000 : 1000;
+    const auto starts = generate_random_data(data_size, data_size);
+    const auto lengths = generate_random_data(data_size, 500);
+    const auto points = generate_random_data(queries, data_size);
+    std::vector<Interval> intervals;
+    for (size_t i = 0; i < data_size; ++i)
+        intervals.push_back(Interval(starts[i], starts[i] + (long_every && i % long_every == 0 ? lengths[i] * 100 : lengths[i])));
+
+    // The baseline keeps intervals ordered by start and, knowing the
+    // longest interval, scans every start in [lo - max_length, hi]
+    double avl_time, std_time;
+    {
+        Timer t;
+        AVLTree::IntervalMultiSet<int> tree;
+        for (const Interval &interval : intervals)
+            tree.insert(interval);
+        avl_time = t.elapsed();
+        sink += tree.size();
+    }
+    {
+        Timer t;
+        std::multimap<int, int> by_start;
+        for (const Interval &interval : intervals)
+            by_start.insert(std::make_pair(interval.start, interval.end));
+        std_time = t.elapsed();
+        sink += by_start.size();
+    }
+    print_result("Insert", avl_time, std_time);
+
+    std::vector<Interval> sorted(intervals);
+    std::sort(sorted.begin(), sorted.end());
+    Timer build_timer;
+    AVLTree::IntervalMultiSet<int> tree(sorted.begin(), sorted.end());
+    avl_time = build_timer.elapsed();
+    Timer map_timer;
+    std::multimap<int, int> by_start;
+    for (const Interval &interval : sorted)
+        by_start.emplace_hint(by_start.end(), interval.start, interval.end);
+    print_result("Build from sorted", avl_time, map_timer.elapsed());
+
+    const int widths[] = {0, 100, 10000};
+    for (int width : widths)
+    {
+        {
+            Timer t;
+            for (int point : points)
+                tree.overlap(point, point + width, [](const Interval &, size_t count) { sink += count; });
+            avl_time = t.elapsed();
+        }
+        {
+            Timer t;
+            for (int point : points)
+            {
+                auto end = by_start.upper_bound(point + width);
+                for (auto it = by_start.lower_bound(point - max_length); it != end; ++it)
+                {
+                    if (it->second >= point)
+                        sink += 1;
+                }
+            }
+            std_time = t.elapsed();
+        }
+        print_result(width == 0 ? "Stab" : "Overlap width " + std::to_string(width), avl_time, std_time);
+    }
+}
+
+void benchmark_shared(size_t data_size)
+{
+    std::cout << "\nBenchmarking shared-memory MultiSet with " << data_size << " keys" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+    std::cout << std::left
+              << std::setw(30) << "Operation"
+              << std::setw(15) << "Shared (ms)"
+              << std::setw(15) << "MultiSet (ms)" << std::endl;
+    std::cout << std::string(60, '-') << std::endl;
+
+    const std::string path = "/dev/shm/avl_shared_benchmark";
+    const auto keys = generate_random_data(data_size, data_size);
+    const auto probes = generate_random_data(data_size, data_size);
+
+    double shared_time, local_time;
+    AVLTree::SharedMultiSet<int> writer(path, data_size * 2);
+    {
+        Timer t;
+        writer.insert(keys.begin(), keys.end());
+        shared_time = t.elapsed();
+    }
+    {
+        Timer t;
+        AVLTree::MultiSet<int> local(keys.begin(), keys.end());
+        local_time = t.elapsed();
+        sink += local.size();
+    }
+    print_result("Bulk build", shared_time, local_time);
+
+    // A new worker either maps the segment or builds its own copy
+    AVLTree::MultiSet<int> local;
+    {
+        Timer t;
+        AVLTree::SharedMultiSet<int> reader(path);
+        sink += reader.count(probes[0]);
+        shared_time = t.elapsed();
+    }
+    {
+        Timer t;
+        local.insert(keys.begin(), keys.end());
+        sink += local.count(probes[0]);
+        local_time = t.elapsed();
+    }
+    print_result("Worker start", shared_time, local_time);
+
+    AVLTree::SharedMultiSet<int> reader(path);
+    {
+        Timer t;
+        for (int probe : probes)
+            sink += reader.count(probe);
+        shared_time = t.elapsed();
+    }
+    {
+        Timer t;
+        for (int probe : probes)
+            sink += local.count(probe);
+        local_time = t.elapsed();
+    }
+    print_result("Count (reader)", shared_time, local_time);
+
+    {
+        Timer t;
+        for (size_t i = 0; i < probes.size(); ++i)
+        {
+            if (i % 2 == 0)
+                writer.insert(probes[i]);
+            else
+                writer.remove(probes[i - 1]);
+        }
+        shared_time = t.elapsed();
+    }
+    {
+        Timer t;
+        for (size_t i = 0; i < probes.size(); ++i)
+        {
+            if (i % 2 == 0)
+                local.insert(probes[i]);
+            else
+                local.remove(probes[i - 1]);
+        }
+        local_time = t.elapsed();
+    }
+    print_result("Insert/remove mixed", shared_time, local_time);
+
+    print_result("Memory per worker (MB)", 0, local.memory_usage().total() / 1048576.0);
+    print_result("Memory per host (MB)", writer.memory_usage().total() / 1048576.0, 0);
+    std::remove(path.c_str());
+}
+
 int main()
 {
     benchmark_operations(50000);
     benchmark_operations(100000);
     benchmark_operations(1000000);
     benchmark_operations(10000000);
+    benchmark_map(100000);
+    benchmark_map(1000000);
+    benchmark_finger(1000000);
+    benchmark_finger(10000000);
+    benchmark_compact(1000000, 10000000);
+    benchmark_sharded(4000000);
+    benchmark_journal(1000000);
+    benchmark_static(1000000);
+    benchmark_sliding_window(100000, 2000000);
+    benchmark_write_buffer(1000000);
+    benchmark_blocked(1000000);
+    benchmark_blocked(10000000);
+    benchmark_merged_view(32, 100000);
+    benchmark_topk(100000000, 100);
+    benchmark_topk(100000000, 10000);
+    benchmark_balance(1000000);
+    benchmark_hash_index(1000000);
+    benchmark_hash_index(10000000);
+    benchmark_interval(1000000, 100000, 0);
+    benchmark_interval(1000000, 10000, 100);
+    benchmark_shared(1000000);
+    benchmark_shared(10000000);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,389 @@
+// Replays an operation trace recorded with AVLTree::TraceRecorder against
+// AVLTree::MultiSet and std::multiset.
+//
+//   trace_replay <trace>                      replay and report
+//   trace_replay --generate <trace> <ops>     write a synthetic mixed trace
+//
+// Each structure replays the trace twice from empty: once untimed per op
+// for throughput and peak heap, once timing every op for the latency
+// percentiles (which include a few tens of ns of clock overhead). Keys of 4 or 8
+// bytes are replayed as int or long long.
+
+#include <set>
+#include <map>
+#include <new>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include "avl_tree.hpp"
+
+// Heap accounting: every allocation carries its size in a header so the
+// replay can report live and peak heap bytes.
+static size_t heap_live = 0;
+static size_t heap_peak = 0;
+static const size_t heap_header = 16;
+
+void *operator new(size_t size)
+{
+    void *block = std::malloc(size + heap_header);
+    if (block == nullptr)
+        throw std::bad_alloc();
+    *static_cast<size_t *>(block) = size;
+    heap_live += size;
+    heap_peak = std::max(heap_peak, heap_live);
+    return static_cast<char *>(block) + heap_header;
+}
+
+void operator delete(void *p) noexcept
+{
+    if (p == nullptr)
+        return;
+    // Integer arithmetic: GCC's bounds checker mistakes the header for an
+    // out-of-bounds read of the caller's array
+    void *block = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(p) - heap_header);
+    heap_live -= *static_cast<size_t *>(block);
+    std::free(block);
+}
+
+// Results are written here so the optimizer cannot drop replayed reads
+volatile long long sink;
+
+static const char *const op_names[] = {"", "insert", "insert_multiple", "bulk_insert", "remove", "remove_multiple",
+                                       "remove_all", "count", "contains", "min", "max", "pop_min", "pop_max", "clear"};
+static const size_t op_kinds = sizeof(op_names) / sizeof(op_names[0]);
+
+template <typename K>
+class AVLTarget
+{
+public:
+    static const char *name() { return "AVLTree"; }
+
+    void apply(const AVLTree::TraceRecord<K> &record, const std::vector<K> &bulk_keys)
+    {
+        try
+        {
+            switch (record.op)
+            {
+            case AVLTree::TraceOp::Insert:
+                set.insert(record.key);
+                break;
+            case AVLTree::TraceOp::InsertMultiple:
+                set.insert_multiple(record.key, record.amount);
+                break;
+            case AVLTree::TraceOp::BulkInsert:
+                set.insert(bulk_keys.begin() + record.bulk_begin, bulk_keys.begin() + record.bulk_begin + record.amount);
+                break;
+            case AVLTree::TraceOp::Remove:
+                set.remove(record.key);
+                break;
+            case AVLTree::TraceOp::RemoveMultiple:
+                set.remove_multiple(record.key, record.amount);
+                break;
+            case AVLTree::TraceOp::RemoveAll:
+                set.remove_all(record.key);
+                break;
+            case AVLTree::TraceOp::Count:
+                sink = sink + set.count(record.key);
+                break;
+            case AVLTree::TraceOp::Contains:
+                sink = sink + set.contains(record.key);
+                break;
+            case AVLTree::TraceOp::Min:
+                sink = sink + set.min();
+                break;
+            case AVLTree::TraceOp::Max:
+                sink = sink + set.max();
+                break;
+            case AVLTree::TraceOp::PopMin:
+                sink = sink + set.pop_min();
+                break;
+            case AVLTree::TraceOp::PopMax:
+                sink = sink + set.pop_max();
+                break;
+            case AVLTree::TraceOp::Clear:
+                set.clear();
+                break;
+            }
+        }
+        catch (const std::runtime_error &)
+        {
+            // min/max/pop on an empty tree threw when recorded as well
+        }
+    }
+
+    size_t size() const { return set.size(); }
+
+private:
+    AVLTree::MultiSet<K> set;
+};
+
+template <typename K>
+class StdTarget
+{
+public:
+    static const char *name() { return "std::multiset"; }
+
+    void apply(const AVLTree::TraceRecord<K> &record, const std::vector<K> &bulk_keys)
+    {
+        typename std::multiset<K>::iterator it;
+        switch (record.op)
+        {
+        case AVLTree::TraceOp::Insert:
+            set.insert(record.key);
+            break;
+        case AVLTree::TraceOp::InsertMultiple:
+            it = set.insert(record.key);
+            for (uint64_t i = 1; i < record.amount; ++i)
+                it = set.insert(it, record.key);
+            break;
+        case AVLTree::TraceOp::BulkInsert:
+            set.insert(bulk_keys.begin() + record.bulk_begin, bulk_keys.begin() + record.bulk_begin + record.amount);
+            break;
+        case AVLTree::TraceOp::Remove:
+            it = set.find(record.key);
+            if (it != set.end())
+                set.erase(it);
+            break;
+        case AVLTree::TraceOp::RemoveMultiple:
+            it = set.lower_bound(record.key);
+            for (uint64_t i = 0; i < record.amount && it != set.end() && *it == record.key; ++i)
+                it = set.erase(it);
+            break;
+        case AVLTree::TraceOp::RemoveAll:
+            set.erase(record.key);
+            break;
+        case AVLTree::TraceOp::Count:
+            sink = sink + set.count(record.key);
+            break;
+        case AVLTree::TraceOp::Contains:
+            sink = sink + (set.find(record.key) != set.end());
+            break;
+        case AVLTree::TraceOp::Min:
+            if (!set.empty())
+                sink = sink + *set.begin();
+            break;
+        case AVLTree::TraceOp::Max:
+            if (!set.empty())
+                sink = sink + *set.rbegin();
+            break;
+        case AVLTree::TraceOp::PopMin:
+            if (!set.empty())
+            {
+                sink = sink + *set.begin();
+                set.erase(set.begin());
+            }
+            break;
+        case AVLTree::TraceOp::PopMax:
+            if (!set.empty())
+            {
+                sink = sink + *set.rbegin();
+                set.erase(std::prev(set.end()));
+            }
+            break;
+        case AVLTree::TraceOp::Clear:
+            set.clear();
+            break;
+        }
+    }
+
+    size_t size() const { return set.size(); }
+
+private:
+    std::multiset<K> set;
+};
+
+struct ReplayResult
+{
+    double seconds;
+    size_t peak_bytes;
+    size_t final_size;
+    std::vector<std::vector<double> > latencies; // nanoseconds, per op kind
+};
+
+// Value at quantile q (0..1) of the samples; reorders them.
+double percentile(std::vector<double> &samples, double q)
+{
+    size_t index = std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+template <typename Target, typename K>
+ReplayResult replay(const AVLTree::TraceReader<K> &trace)
+{
+    typedef std::chrono::steady_clock Clock;
+    ReplayResult result;
+    const std::vector<AVLTree::TraceRecord<K> > &records = trace.records;
+
+    {
+        size_t baseline = heap_live;
+        heap_peak = heap_live;
+        Target target;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < records.size(); ++i)
+            target.apply(records[i], trace.bulk_keys);
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        result.peak_bytes = heap_peak - baseline;
+        result.final_size = target.size();
+    }
+
+    result.latencies.assign(op_kinds, std::vector<double>());
+    for (size_t i = 0; i < records.size(); ++i)
+        result.latencies[static_cast<size_t>(records[i].op)].reserve(records.size() / 4);
+    {
+        Target target;
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            Clock::time_point start = Clock::now();
+            target.apply(records[i], trace.bulk_keys);
+            Clock::time_point end = Clock::now();
+            result.latencies[static_cast<size_t>(records[i].op)].push_back(
+                std::chrono::duration<double, std::nano>(end - start).count());
+        }
+    }
+    return result;
+}
+
+void print_latencies(const char *name, std::vector<double> samples)
+{
+    if (samples.empty())
+        return;
+    std::cout << std::left << std::setw(20) << name << std::right << std::setw(12) << samples.size();
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (size_t q = 0; q < 4; ++q)
+        std::cout << std::setw(10) << percentile(samples, quantiles[q]);
+    std::cout << std::setw(12) << *std::max_element(samples.begin(), samples.end()) << std::endl;
+}
+
+template <typename Target, typename K>
+void report(const AVLTree::TraceReader<K> &trace)
+{
+    ReplayResult result = replay<Target>(trace);
+    std::cout << "\n"
+              << Target::name() << std::endl;
+    std::cout << std::string(86, '-') << std::endl;
+    std::cout << std::fixed << std::setprecision(0)
+              << "Throughput: " << trace.records.size() / result.seconds << " ops/s ("
+              << std::setprecision(2) << result.seconds * 1000 << " ms)"
+              << ", peak heap: " << result.peak_bytes / 1024.0 << " KiB"
+              << ", final size: " << result.final_size << std::endl;
+    std::cout << std::left << std::setw(20) << "Op (ns)" << std::right << std::setw(12) << "calls"
+              << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99"
+              << std::setw(10) << "p99.9" << std::setw(12) << "max" << std::endl;
+    std::cout << std::setprecision(0);
+    std::vector<double> all;
+    for (size_t op = 1; op < op_kinds; ++op)
+    {
+        print_latencies(op_names[op], result.latencies[op]);
+        all.insert(all.end(), result.latencies[op].begin(), result.latencies[op].end());
+    }
+    print_latencies("all", all);
+}
+
+template <typename K>
+void run(const std::string &path)
+{
+    AVLTree::TraceReader<K> trace(path);
+    std::cout << "Trace " << path << ": " << trace.records.size() << " records, "
+              << trace.bulk_keys.size() << " bulk keys, " << sizeof(K) << "-byte keys" << std::endl;
+    if (trace.records.empty())
+        return;
+    report<AVLTarget<K> >(trace);
+    report<StdTarget<K> >(trace);
+}
+
+// Mixed workload over a key space skewed towards small keys: mostly inserts and lookups,
+// some removals and pops, one bulk load up front.
+void generate(const std::string &path, size_t ops)
+{
+    AVLTree::TraceRecorder<int> recorder(path);
+    AVLTree::MultiSet<int> set;
+    set.attach_trace(&recorder);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> keys(0, static_cast<int>(std::max<size_t>(ops / 2, 1)));
+    std::uniform_int_distribution<int> kind(0, 99);
+    std::vector<int> bulk;
+    for (size_t i = 0; i < ops / 10; ++i)
+        bulk.push_back(keys(gen));
+    set.insert(bulk.begin(), bulk.end());
+    for (size_t i = 0; i < ops; ++i)
+    {
+        int key = keys(gen) / (1 + kind(gen) % 4);
+        int k = kind(gen);
+        try
+        {
+            if (k < 35)
+                set.insert(key);
+            else if (k < 40)
+                set.insert_multiple(key, 3);
+            else if (k < 55)
+                set.remove(key);
+            else if (k < 57)
+                set.remove_all(key);
+            else if (k < 75)
+                set.count(key);
+            else if (k < 93)
+                set.contains(key);
+            else if (k < 96)
+                set.min();
+            else if (k < 98)
+                set.pop_min();
+            else
+                set.pop_max();
+        }
+        catch (const std::runtime_error &)
+        {
+        }
+    }
+    set.attach_trace(nullptr);
+    std::cout << "Wrote " << recorder.records() << " records to " << path << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        if (argc == 4 && std::string(argv[1]) == "--generate")
+        {
+            generate(argv[2], std::strtoull(argv[3], nullptr, 10));
+            return 0;
+        }
+        if (argc != 2)
+        {
+            std::cerr << "usage: " << argv[0] << " <trace>\n"
+                      << "       " << argv[0] << " --generate <trace> <ops>" << std::endl;
+            return 2;
+        }
+
+        std::FILE *file = std::fopen(argv[1], "rb");
+        char magic[4];
+        uint32_t key_size = 0;
+        bool ok = file && std::fread(magic, 1, 4, file) == 4 && std::fread(&key_size, sizeof(key_size), 1, file) == 1;
+        if (file)
+            std::fclose(file);
+        if (!ok)
+            throw std::runtime_error(std::string("Cannot read trace ") + argv[1]);
+        if (key_size == sizeof(int))
+            run<int>(argv[1]);
+        else if (key_size == sizeof(long long))
+            run<long long>(argv[1]);
+        else
+            throw std::runtime_error("Unsupported key size " + std::to_string(key_size));
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "trace_replay: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}